@@ -0,0 +1,319 @@
+/*
+ * Lumos: IIO ambient light sensor
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "als.h"
+#include "stats.h"
+
+extern int verbose;
+
+#define LUX_LUMA_PER_DECADE 51.0 // 10^5 lux (sunlight) lands at 255
+#define BUFFER_LENGTH "16"
+#define SCAN_MAX 64
+
+static int read_attr(const char *dir, const char *name, char *buf, size_t len) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int write_attr(const char *dir, const char *name, const char *val) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    int ok = fputs(val, f) >= 0;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+static double attr_double(const char *dir, const char *name, double fallback) {
+    char buf[64];
+    return read_attr(dir, name, buf, sizeof(buf)) == 0 ? atof(buf) : fallback;
+}
+
+// in_illuminance[N]_raw or in_illuminance[N]_input (not _ir_, _clear_ ...)
+static int channel_of(const char *file, char *channel, size_t len, int *processed) {
+    const char *p = file + strlen("in_illuminance");
+    if (strncmp(file, "in_illuminance", strlen("in_illuminance")) != 0) return -1;
+    while (isdigit((unsigned char)*p)) p++;
+    if (strcmp(p, "_raw") == 0) *processed = 0;
+    else if (strcmp(p, "_input") == 0) *processed = 1;
+    else return -1;
+    snprintf(channel, len, "%.*s", (int)(p - file), file);
+    return 0;
+}
+
+// Picks the illuminance channel in dir, preferring raw (it has a scan element)
+static int find_channel(Als *a) {
+    DIR *d = opendir(a->dir);
+    if (!d) return -1;
+    struct dirent *e;
+    int found = 0;
+    while ((e = readdir(d)) != NULL) {
+        char channel[48];
+        int processed;
+        if (channel_of(e->d_name, channel, sizeof(channel), &processed) < 0) continue;
+        if (found && !processed && a->processed) found = 0; // Raw beats input
+        if (found) continue;
+        snprintf(a->channel, sizeof(a->channel), "%s", channel);
+        a->processed = processed;
+        found = 1;
+    }
+    closedir(d);
+    return found ? 0 : -1;
+}
+
+static int find_device(char *dir, size_t len) {
+    DIR *d = opendir(ALS_IIO_DEVICES);
+    if (!d) return -1;
+    struct dirent *e;
+    int found = 0;
+    while (!found && (e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "iio:device", 10) != 0) continue;
+        Als probe;
+        memset(&probe, 0, sizeof(probe));
+        snprintf(probe.dir, sizeof(probe.dir), "%s/%.64s", ALS_IIO_DEVICES, e->d_name);
+        if (find_channel(&probe) == 0) {
+            snprintf(dir, len, "%s", probe.dir);
+            found = 1;
+        }
+    }
+    closedir(d);
+    return found ? 0 : -1;
+}
+
+// "le:u12/16>>4"
+static int parse_type(Als *a, const char *type) {
+    char endian[3], sign;
+    int bits, storage, shift = 0;
+    if (sscanf(type, "%2[bl]e:%c%d/%d>>%d", endian, &sign, &bits, &storage, &shift) < 4) return -1;
+    // Anything the decode can't take (zero-size records, shifts past the word) leaves us on sysfs
+    if (storage <= 0 || storage % 8 || storage > 64 || bits <= 0 || shift < 0 || shift >= storage ||
+        bits + shift > storage || (sign != 's' && sign != 'u'))
+        return -1;
+    a->big_endian = endian[0] == 'b';
+    a->is_signed = sign == 's';
+    a->bits = bits;
+    a->bytes = storage / 8;
+    a->shift = shift;
+    return 0;
+}
+
+// Any other channel in the scan would shift ours; only a trailing timestamp is fine
+static int others_enabled(const char *scan_dir, const char *own, int *timestamp) {
+    DIR *d = opendir(scan_dir);
+    if (!d) return -1;
+    struct dirent *e;
+    int others = 0;
+    *timestamp = 0;
+    while ((e = readdir(d)) != NULL) {
+        size_t n = strlen(e->d_name);
+        if (n < 4 || strcmp(e->d_name + n - 3, "_en") != 0 || strcmp(e->d_name, own) == 0) continue;
+        char val[8];
+        if (read_attr(scan_dir, e->d_name, val, sizeof(val)) < 0 || atoi(val) == 0) continue;
+        if (strcmp(e->d_name, "in_timestamp_en") == 0) *timestamp = 1;
+        else others = 1;
+    }
+    closedir(d);
+    return others;
+}
+
+// The device's own trigger (hid-sensor-als names it after the device)
+static void pick_trigger(const char *dir) {
+    char current[64];
+    if (read_attr(dir, "trigger/current_trigger", current, sizeof(current)) < 0 || current[0]) return;
+
+    const char *dev = strrchr(dir, '/');
+    int index = dev ? atoi(dev + 1 + strlen("iio:device")) : 0;
+    DIR *d = opendir(ALS_IIO_DEVICES);
+    if (!d) return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "trigger", 7) != 0) continue;
+        char tdir[512], name[64], want[32];
+        snprintf(tdir, sizeof(tdir), "%s/%s", ALS_IIO_DEVICES, e->d_name);
+        snprintf(want, sizeof(want), "-dev%d", index);
+        if (read_attr(tdir, "name", name, sizeof(name)) == 0 && strstr(name, want)) {
+            write_attr(dir, "trigger/current_trigger", name);
+            break;
+        }
+    }
+    closedir(d);
+}
+
+static void buffer_stop(Als *a) {
+    char scan_dir[300], en[64];
+    if (a->fd_buffer < 0) return;
+    close(a->fd_buffer);
+    a->fd_buffer = -1;
+    write_attr(a->dir, "buffer/enable", "0");
+    snprintf(scan_dir, sizeof(scan_dir), "%s/scan_elements", a->dir);
+    snprintf(en, sizeof(en), "%s_en", a->channel);
+    write_attr(scan_dir, en, "0");
+}
+
+static int buffer_start(Als *a) {
+    char scan_dir[300], en[64], type_name[64], type[32], dev[300];
+    const char *name = strrchr(a->dir, '/');
+    if (a->processed || !name) return -1;
+
+    snprintf(dev, sizeof(dev), "/dev/%s", name + 1);
+    snprintf(scan_dir, sizeof(scan_dir), "%s/scan_elements", a->dir);
+    snprintf(en, sizeof(en), "%s_en", a->channel);
+    snprintf(type_name, sizeof(type_name), "%s_type", a->channel);
+    if (access(dev, R_OK) < 0 || read_attr(scan_dir, type_name, type, sizeof(type)) < 0 || parse_type(a, type) < 0)
+        return -1;
+
+    int timestamp;
+    if (others_enabled(scan_dir, en, &timestamp) != 0) return -1;
+    a->record = timestamp ? ((a->bytes + 7) / 8) * 8 + 8 : a->bytes;
+
+    pick_trigger(a->dir);
+    write_attr(a->dir, "buffer/enable", "0");
+    if (write_attr(scan_dir, en, "1") < 0 || write_attr(a->dir, "buffer/length", BUFFER_LENGTH) < 0) return -1;
+    if (write_attr(a->dir, "buffer/enable", "1") < 0) {
+        write_attr(scan_dir, en, "0");
+        return -1;
+    }
+    a->fd_buffer = open(dev, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (a->fd_buffer < 0) {
+        write_attr(a->dir, "buffer/enable", "0");
+        write_attr(scan_dir, en, "0");
+        return -1;
+    }
+    return 0;
+}
+
+int als_open(Als *a, const char *spec) {
+    memset(a, 0, sizeof(*a));
+    a->fd_value = -1;
+    a->fd_buffer = -1;
+    a->lux = -1.0;
+
+    if (strcmp(spec, "auto") == 0) {
+        if (find_device(a->dir, sizeof(a->dir)) < 0) return -1;
+    } else {
+        snprintf(a->dir, sizeof(a->dir), "%s", spec);
+    }
+    if (find_channel(a) < 0) {
+        if (verbose) fprintf(stderr, "No illuminance channel in %s\n", a->dir);
+        return -1;
+    }
+
+    char name[64], path[512];
+    snprintf(path, sizeof(path), "%s/%s_%s", a->dir, a->channel, a->processed ? "input" : "raw");
+    a->fd_value = open(path, O_RDONLY | O_CLOEXEC);
+    if (a->fd_value < 0) return -1;
+
+    // Scale and offset may be per channel or shared by all illuminance channels
+    snprintf(name, sizeof(name), "%s_scale", a->channel);
+    a->scale = attr_double(a->dir, name, attr_double(a->dir, "in_illuminance_scale", 1.0));
+    snprintf(name, sizeof(name), "%s_offset", a->channel);
+    a->offset = attr_double(a->dir, name, attr_double(a->dir, "in_illuminance_offset", 0.0));
+    if (a->processed) {
+        a->scale = 1.0;
+        a->offset = 0.0;
+    }
+
+    if (buffer_start(a) < 0) a->fd_buffer = -1;
+    if (verbose) printf("ALS: %s/%s (%s)\n", a->dir, a->channel, a->fd_buffer >= 0 ? "buffered" : "sysfs");
+    return 0;
+}
+
+void als_close(Als *a) {
+    buffer_stop(a);
+    if (a->fd_value >= 0) close(a->fd_value);
+    a->fd_value = -1;
+}
+
+int als_is_open(const Als *a) {
+    return a->fd_value >= 0;
+}
+
+int als_buffered(const Als *a) {
+    return a->fd_buffer >= 0;
+}
+
+static double decode(const Als *a, const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < a->bytes; i++) {
+        int b = a->big_endian ? i : a->bytes - 1 - i;
+        v = (v << 8) | p[b];
+    }
+    v >>= a->shift;
+    if (a->bits < 64) v &= (1ull << a->bits) - 1;
+    if (a->is_signed && a->bits < 64 && (v & (1ull << (a->bits - 1)))) return (double)(int64_t)(v - (1ull << a->bits));
+    return (double)v;
+}
+
+// Newest scan in the buffer, if any arrived since the last read
+static int read_buffer(Als *a, double *raw) {
+    unsigned char buf[SCAN_MAX * 16];
+    int got = 0;
+    for (;;) {
+        ssize_t n = read(a->fd_buffer, buf, sizeof(buf) - sizeof(buf) % a->record);
+        if (n < a->record) {
+            if (n < 0 && errno != EAGAIN) return -1;
+            break;
+        }
+        *raw = decode(a, buf + (n / a->record - 1) * a->record);
+        got = 1;
+    }
+    return got;
+}
+
+static int read_sysfs(Als *a, double *raw) {
+    char buf[32];
+    ssize_t n = pread(a->fd_value, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    *raw = atof(buf);
+    return 0;
+}
+
+double als_read(Als *a) {
+    if (!als_is_open(a)) return -1.0;
+
+    uint64_t t0 = stats_now();
+    double raw;
+    int rc = a->fd_buffer >= 0 ? read_buffer(a, &raw) : read_sysfs(a, &raw);
+    // No scan yet: the raw attribute usually still answers
+    if (rc == 0 && a->fd_buffer >= 0 && a->lux < 0.0 && read_sysfs(a, &raw) == 0) rc = 1;
+    stats_record(STAGE_ALS_READ, t0);
+
+    if (rc < 0) return -1.0;
+    if (rc == 1 || a->fd_buffer < 0) {
+        a->lux = (raw + a->offset) * a->scale;
+        if (a->lux < 0.0) a->lux = 0.0;
+    }
+    return a->lux;
+}
+
+double als_luma(double lux, double gain) {
+    double luma = gain * LUX_LUMA_PER_DECADE * log10(1.0 + (lux > 0.0 ? lux : 0.0));
+    return luma > 255.0 ? 255.0 : luma;
+}
+
+double als_gain_for(double lux, double luma) {
+    double base = als_luma(lux, 1.0);
+    return base < 10.0 ? -1.0 : luma / base;
+}
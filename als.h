@@ -0,0 +1,49 @@
+/*
+ * Lumos: IIO ambient light sensor
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_ALS_H
+#define LUMOS_ALS_H
+
+#define ALS_IIO_DEVICES "/sys/bus/iio/devices"
+
+// An illuminance channel (in_illuminance[N]_raw or _input) on an IIO device.
+// Where the driver has a buffer, samples are taken from /dev/iio:deviceN;
+// otherwise, or if the buffer can't be set up, from sysfs raw x scale.
+typedef struct {
+    char dir[256];      // e.g. /sys/bus/iio/devices/iio:device0
+    char channel[48];   // e.g. in_illuminance
+    int fd_value;       // sysfs *_raw or *_input, kept open
+    int processed;      // *_input: already lux
+    double scale;
+    double offset;
+
+    int fd_buffer;      // Character device, -1 if not buffered
+    int bytes;          // Storage size of the channel in a scan
+    int record;         // Whole scan, with a timestamp if one is enabled
+    int bits;
+    int shift;
+    int is_signed;
+    int big_endian;
+
+    double lux;         // Latest reading, -1 before the first
+} Als;
+
+// spec is "auto" (first illuminance channel found) or an IIO device directory
+int als_open(Als *a, const char *spec);
+void als_close(Als *a);
+int als_is_open(const Als *a);
+int als_buffered(const Als *a);
+
+// Latest illuminance in lux, -1 on failure. Buffered sensors may only push
+// a scan when the light changes, so the last one stands until the next.
+double als_read(Als *a);
+
+// Lux onto the camera's 0-255 luma scale (logarithmic, ~255 at 100k lux)
+double als_luma(double lux, double gain);
+// Gain that makes lux read as the given camera luma; -1 if the light is too low to tell
+double als_gain_for(double lux, double luma);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Lumos: sysfs backlight device
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "backlight.h"
+#include "stats.h"
+
+extern int verbose;
+
+static int open_attr(const char *dir, const char *name, int flags) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, flags | O_CLOEXEC);
+}
+
+// sysfs attributes must always be read from offset 0
+static int pread_int(int fd) {
+    char buf[32];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    return atoi(buf);
+}
+
+int backlight_open(Backlight *bl, const char *path) {
+    memset(bl, 0, sizeof(*bl));
+    bl->fd_brightness = -1;
+    bl->fd_actual = -1;
+    strncpy(bl->path, path, sizeof(bl->path) - 1);
+
+    int fd_max = open_attr(path, "max_brightness", O_RDONLY);
+    if (fd_max < 0) return -1;
+    bl->max = pread_int(fd_max);
+    close(fd_max);
+    if (bl->max <= 0) return -1;
+
+    bl->fd_brightness = open_attr(path, "brightness", O_RDWR);
+    if (bl->fd_brightness < 0) {
+        // Still useful read-only (e.g. run without permissions for debugging)
+        bl->fd_brightness = open_attr(path, "brightness", O_RDONLY);
+        if (bl->fd_brightness < 0) return -1;
+        if (verbose) fprintf(stderr, "Warning: %s/brightness is read-only\n", path);
+    }
+    bl->fd_actual = open_attr(path, "actual_brightness", O_RDONLY);
+
+    return backlight_read(bl) < 0 ? -1 : 0;
+}
+
+void backlight_close(Backlight *bl) {
+    if (bl->fd_brightness >= 0) close(bl->fd_brightness);
+    if (bl->fd_actual >= 0) close(bl->fd_actual);
+    bl->fd_brightness = bl->fd_actual = -1;
+}
+
+int backlight_read(Backlight *bl) {
+    uint64_t t0 = stats_now();
+    int val = pread_int(bl->fd_actual >= 0 ? bl->fd_actual : bl->fd_brightness);
+    stats_record(STAGE_SYSFS_READ, t0);
+    if (val >= 0) atomic_store(&bl->current, val);
+    return val;
+}
+
+int backlight_write(Backlight *bl, int val) {
+    if (val < 0) val = 0;
+    if (val > bl->max) val = bl->max;
+    if (val == atomic_load(&bl->current)) {
+        stats_count(COUNT_WRITES_SKIPPED);
+        return 0;
+    }
+
+    // Newline-terminated like echo, so a plain file stand-in still parses
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "%d\n", val);
+    uint64_t t0 = stats_now();
+    if (pwrite(bl->fd_brightness, buf, len, 0) != len) {
+        stats_count(COUNT_WRITE_FAILURES);
+        if (verbose) perror("Failed to write brightness");
+        return -1;
+    }
+    stats_record(STAGE_SYSFS_WRITE, t0);
+    stats_count(COUNT_WRITES);
+    atomic_store(&bl->current, val);
+    return 1;
+}
+
+int backlight_notify_fd(const Backlight *bl) {
+    return bl->fd_actual;
+}
+
+int backlight_powered(const Backlight *bl) {
+    int fd = open_attr(bl->path, "bl_power", O_RDONLY);
+    if (fd < 0) return -1;
+    int v = pread_int(fd);
+    close(fd);
+    return v < 0 ? -1 : v == 0;
+}
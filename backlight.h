@@ -0,0 +1,41 @@
+/*
+ * Lumos: sysfs backlight device
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_BACKLIGHT_H
+#define LUMOS_BACKLIGHT_H
+
+#include <stdatomic.h>
+
+// Descriptors stay open for the daemon's lifetime; reads and writes are a
+// single pread()/pwrite() each. `current` tracks the hardware level and is
+// refreshed from sysfs change notifications, so hot paths never re-read it.
+typedef struct {
+    char path[512];
+    int fd_brightness;
+    int fd_actual;   // actual_brightness, or -1 if the driver lacks it
+    int max;
+    atomic_int current;
+} Backlight;
+
+int backlight_open(Backlight *bl, const char *path);
+void backlight_close(Backlight *bl);
+
+// Reads the hardware level and refreshes the cache
+int backlight_read(Backlight *bl);
+// Writes a level; a no-op if the hardware is already there
+int backlight_write(Backlight *bl, int val);
+
+static inline int backlight_current(Backlight *bl) {
+    return atomic_load(&bl->current);
+}
+
+// Descriptor that raises POLLPRI when the level changes behind our back
+int backlight_notify_fd(const Backlight *bl);
+
+// bl_power: 1 lit (FB_BLANK_UNBLANK), 0 blanked, -1 if the driver lacks it
+int backlight_powered(const Backlight *bl);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ * Lumos: benchmark suite
+ * Author: Anıl Aras
+ * License: MIT
+ *
+ * Three parts, reported together as one JSON document:
+ *   luma  - the statistics kernels over synthetic frames at common resolutions
+ *   loop  - capture -> luma -> curve -> sysfs write, against a synthetic source
+ *           and a temp-dir backlight
+ *   ipc   - many concurrent clients against a real daemon started in a temp dir
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "luma.h"
+#include "backlight.h"
+#include "source.h"
+#include "config.h"
+#include "control.h"
+#include "stats.h"
+
+#define LUMA_MIN_SECONDS 0.25   // Per resolution and kernel
+#define LOOP_ITERATIONS 20000
+#define IPC_CLIENTS 16
+#define IPC_REQUESTS 2000       // Per client and phase
+#define IPC_BATCH 64            // Commands in flight per client when pipelining
+#define DAEMON_START_TIMEOUT 5.0
+
+int verbose = 0;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts in place
+static double percentile(double *v, size_t n, double q) {
+    if (n == 0) return 0.0;
+    qsort(v, n, sizeof(*v), cmp_double);
+    return v[(size_t)(q * (n - 1))];
+}
+
+static void write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fputs(text, f);
+    fclose(f);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+// Luma kernels
+
+typedef void (*LumaKernel)(const unsigned char *, size_t, LumaStats *);
+
+static const struct {
+    unsigned int width;
+    unsigned int height;
+} resolutions[] = {
+    { 160, 120 }, { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }
+};
+
+static double time_kernel(LumaKernel kernel, const unsigned char *buf, size_t bytes) {
+    LumaStats st;
+    long iterations = 0;
+    double start = now_s(), elapsed;
+    long batch = 1;
+    do {
+        for (long i = 0; i < batch; i++) kernel(buf, bytes, &st);
+        iterations += batch;
+        batch *= 2;
+        elapsed = now_s() - start;
+    } while (elapsed < LUMA_MIN_SECONDS);
+    return elapsed * 1e9 / iterations;
+}
+
+static int same_stats(const LumaStats *a, const LumaStats *b) {
+    return a->mean == b->mean && a->min == b->min && a->max == b->max && a->count == b->count &&
+           memcmp(a->hist, b->hist, sizeof(a->hist)) == 0;
+}
+
+static int bench_luma(FILE *out) {
+    int all_match = 1;
+    unsigned int seed = 12345;
+
+    fprintf(out, "  \"luma\": [\n");
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+        size_t bytes = (size_t)resolutions[r].width * resolutions[r].height * 2;
+        unsigned char *buf = malloc(bytes);
+        if (!buf) return -1;
+        for (size_t i = 0; i < bytes; i++) buf[i] = rand_r(&seed) & 0xff;
+
+        LumaStats fast, ref;
+        luma_stats_yuyv(buf, bytes, &fast);
+        luma_stats_yuyv_scalar(buf, bytes, &ref);
+        int match = same_stats(&fast, &ref);
+        all_match &= match;
+
+        double ns = time_kernel(luma_stats_yuyv, buf, bytes);
+        double scalar_ns = time_kernel(luma_stats_yuyv_scalar, buf, bytes);
+        fprintf(out, "    {\"width\": %u, \"height\": %u, \"kernel\": \"%s\", \"ns_per_frame\": %.1f, "
+                "\"gbytes_per_s\": %.3f, \"scalar_ns_per_frame\": %.1f, \"speedup\": %.2f, \"matches_scalar\": %s}%s\n",
+                resolutions[r].width, resolutions[r].height, luma_kernel_name(), ns, bytes / ns,
+                scalar_ns, scalar_ns / ns, match ? "true" : "false",
+                r + 1 < sizeof(resolutions) / sizeof(resolutions[0]) ? "," : "");
+        free(buf);
+    }
+    fprintf(out, "  ],\n");
+    return all_match ? 0 : -1;
+}
+
+// Control loop
+
+static void bench_loop(FILE *out, const char *dir) {
+    char bl_dir[512], path[600];
+    snprintf(bl_dir, sizeof(bl_dir), "%s/loop-bl", dir);
+    mkdir(bl_dir, 0755);
+    snprintf(path, sizeof(path), "%s/max_brightness", bl_dir);
+    write_file(path, "1000\n");
+    snprintf(path, sizeof(path), "%s/brightness", bl_dir);
+    write_file(path, "0\n");
+
+    Backlight bl;
+    FrameSource src;
+    // Light swings every 100 ms so a good share of iterations really write
+    if (backlight_open(&bl, bl_dir) < 0 || source_open(&src, "synth:10-250/0.05,250-10/0.05") < 0) {
+        fprintf(out, "  \"loop\": null,\n");
+        return;
+    }
+
+    Config cfg;
+    config_defaults(&cfg);
+    Tracker tracker;
+    tracker_reset(&tracker);
+    Curve curve;
+    curve_reset(&curve);
+    curve_compile(&curve, &cfg);
+    double *lat = malloc(LOOP_ITERATIONS * sizeof(double));
+    uint64_t writes_before = stats_counter(COUNT_WRITES);
+
+    double start = now_s();
+    for (int i = 0; i < LOOP_ITERATIONS; i++) {
+        double t0 = now_s();
+        CameraFrame frame;
+        LumaStats st;
+        if (source_dequeue(&src, &frame) != 1) break;
+        luma_stats_yuyv(frame.data, frame.bytesused, &st);
+        source_requeue(&src, &frame);
+        tracker_update(&tracker, &cfg, st.mean, t0);
+        backlight_write(&bl, control_level(control_auto_percent(&cfg, &curve, tracker.estimate), bl.max));
+        lat[i] = (now_s() - t0) * 1e6;
+    }
+    double elapsed = now_s() - start;
+
+    fprintf(out, "  \"loop\": {\"iterations\": %d, \"source\": \"synth\", \"resolution\": \"%ux%u\", "
+            "\"us_per_iteration\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+            "\"backlight_writes\": %llu},\n",
+            LOOP_ITERATIONS, src.mode.width, src.mode.height, elapsed * 1e6 / LOOP_ITERATIONS,
+            percentile(lat, LOOP_ITERATIONS, 0.5), percentile(lat, LOOP_ITERATIONS, 0.99),
+            percentile(lat, LOOP_ITERATIONS, 1.0),
+            (unsigned long long)(stats_counter(COUNT_WRITES) - writes_before));
+
+    free(lat);
+    source_close(&src);
+    backlight_close(&bl);
+}
+
+// IPC
+
+typedef struct {
+    const char *socket_path;
+    pthread_barrier_t *barrier;
+    int pipelined;
+    double *lat;       // Round trip per request, or per batch when pipelined
+    int n_lat;
+    double start;
+    double end;
+    int errors;
+} Client;
+
+static int connect_to(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads until `lines` replies have arrived
+static int read_lines(int fd, int lines) {
+    char buf[4096];
+    while (lines > 0) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) return -1;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') lines--;
+        }
+    }
+    return 0;
+}
+
+static void *client_run(void *arg) {
+    Client *c = arg;
+    int fd = connect_to(c->socket_path);
+    pthread_barrier_wait(c->barrier);
+    c->start = now_s();
+    if (fd < 0) {
+        c->errors++;
+        c->end = now_s();
+        return NULL;
+    }
+
+    if (!c->pipelined) {
+        for (int i = 0; i < IPC_REQUESTS; i++) {
+            double t0 = now_s();
+            if (write(fd, "GET brightness\n", 15) != 15 || read_lines(fd, 1) < 0) {
+                c->errors++;
+                break;
+            }
+            c->lat[c->n_lat++] = (now_s() - t0) * 1e6;
+        }
+    } else {
+        char batch[IPC_BATCH * 9 + 1];
+        for (int i = 0; i < IPC_BATCH; i++) memcpy(batch + i * 9, "GET mode\n", 9);
+        for (int i = 0; i < IPC_REQUESTS / IPC_BATCH; i++) {
+            double t0 = now_s();
+            if (write(fd, batch, IPC_BATCH * 9) != IPC_BATCH * 9 || read_lines(fd, IPC_BATCH) < 0) {
+                c->errors++;
+                break;
+            }
+            c->lat[c->n_lat++] = (now_s() - t0) * 1e6;
+        }
+    }
+    c->end = now_s();
+    close(fd);
+    return NULL;
+}
+
+static void ipc_phase(FILE *out, const char *socket_path, int pipelined) {
+    pthread_t threads[IPC_CLIENTS];
+    Client clients[IPC_CLIENTS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, IPC_CLIENTS);
+
+    for (int i = 0; i < IPC_CLIENTS; i++) {
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].socket_path = socket_path;
+        clients[i].barrier = &barrier;
+        clients[i].pipelined = pipelined;
+        clients[i].lat = malloc(IPC_REQUESTS * sizeof(double));
+        pthread_create(&threads[i], NULL, client_run, &clients[i]);
+    }
+
+    double *all = malloc(IPC_CLIENTS * IPC_REQUESTS * sizeof(double));
+    size_t n = 0;
+    long requests = 0;
+    int errors = 0;
+    double start = 0.0, end = 0.0;
+    for (int i = 0; i < IPC_CLIENTS; i++) {
+        pthread_join(threads[i], NULL);
+        memcpy(all + n, clients[i].lat, clients[i].n_lat * sizeof(double));
+        n += clients[i].n_lat;
+        requests += (long)clients[i].n_lat * (pipelined ? IPC_BATCH : 1);
+        errors += clients[i].errors;
+        if (i == 0 || clients[i].start < start) start = clients[i].start;
+        if (clients[i].end > end) end = clients[i].end;
+        free(clients[i].lat);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    fprintf(out, "    \"%s\": {\"requests\": %ld, \"errors\": %d, \"requests_per_s\": %.0f, "
+            "\"%s_p50_us\": %.1f, \"%s_p99_us\": %.1f, \"%s_max_us\": %.1f}",
+            pipelined ? "pipelined" : "roundtrip", requests, errors,
+            end > start ? requests / (end - start) : 0.0,
+            pipelined ? "batch" : "request", percentile(all, n, 0.5),
+            pipelined ? "batch" : "request", percentile(all, n, 0.99),
+            pipelined ? "batch" : "request", percentile(all, n, 1.0));
+    free(all);
+}
+
+static pid_t start_daemon(const char *daemon, const char *dir, char *socket_path, size_t len) {
+    char bl_dir[512], conf[512], path[600];
+    snprintf(bl_dir, sizeof(bl_dir), "%s/ipc-bl", dir);
+    mkdir(bl_dir, 0755);
+    snprintf(path, sizeof(path), "%s/max_brightness", bl_dir);
+    write_file(path, "1000\n");
+    snprintf(path, sizeof(path), "%s/brightness", bl_dir);
+    write_file(path, "500\n");
+    snprintf(conf, sizeof(conf), "%s/lumos.conf", dir);
+    write_file(conf, "mode=manual\nmanual_brightness=50\nramp_ms=0\ncamera_dev=synth:128/60\n");
+    snprintf(socket_path, len, "%s/lumos.sock", dir);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execl(daemon, daemon, "-c", conf, "-b", bl_dir, "-r", dir, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) return -1;
+
+    double deadline = now_s() + DAEMON_START_TIMEOUT;
+    while (now_s() < deadline) {
+        int fd = connect_to(socket_path);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) return -1;
+        usleep(10000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void bench_ipc(FILE *out, const char *daemon, const char *dir) {
+    char socket_path[600];
+    pid_t pid = daemon ? start_daemon(daemon, dir, socket_path, sizeof(socket_path)) : -1;
+    if (pid < 0) {
+        if (daemon) fprintf(stderr, "Could not start %s; skipping the IPC benchmark\n", daemon);
+        fprintf(out, "  \"ipc\": null\n");
+        return;
+    }
+
+    fprintf(out, "  \"ipc\": {\n    \"clients\": %d,\n", IPC_CLIENTS);
+    ipc_phase(out, socket_path, 0);
+    fprintf(out, ",\n");
+    ipc_phase(out, socket_path, 1);
+    fprintf(out, "\n  }\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS]\n", prog);
+    printf("Options:\n");
+    printf("  -d <path>      Daemon binary for the IPC benchmark (skipped if absent)\n");
+    printf("  -o <path>      Write JSON here instead of stdout\n");
+    printf("  -h             Show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *daemon = NULL;
+    const char *out_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:o:h")) != -1) {
+        switch (opt) {
+            case 'd': daemon = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror("Cannot open output");
+        return 1;
+    }
+
+    char dir[] = "/tmp/lumos-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(out, "{\n  \"version\": 1,\n  \"timestamp\": %ld,\n  \"luma_kernel\": \"%s\",\n",
+            (long)time(NULL), luma_kernel_name());
+    int rc = bench_luma(out);
+    bench_loop(out, dir);
+    bench_ipc(out, daemon, dir);
+    fprintf(out, "}\n");
+
+    if (out != stdout) fclose(out);
+    nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+
+    if (rc < 0) fprintf(stderr, "SIMD luma kernel disagrees with the scalar reference\n");
+    return rc < 0 ? 1 : 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * Lumos: V4L2 capture session
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "camera.h"
+#include "stats.h"
+
+// Used when the driver can't enumerate frame sizes
+#define CAMERA_FALLBACK_WIDTH 640
+#define CAMERA_FALLBACK_HEIGHT 480
+// Smallest frame still worth metering; anything bigger only costs USB bandwidth
+#define CAMERA_MIN_WIDTH 160
+#define CAMERA_MIN_HEIGHT 120
+#define CAMERA_MODE_CACHE 8
+
+extern int verbose;
+
+static struct {
+    char dev[64];
+    CameraMode mode;
+} mode_cache[CAMERA_MODE_CACHE];
+static int mode_cache_len = 0;
+
+static int xioctl(int fd, unsigned long req, void *arg) {
+    int r;
+    do {
+        r = ioctl(fd, req, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+// MJPEG is metered from its DC coefficients (see mjpeg.c)
+static int format_supported(unsigned int fourcc) {
+    return fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_MJPEG;
+}
+
+static int meets_floor(const CameraMode *m) {
+    return m->width >= CAMERA_MIN_WIDTH && m->height >= CAMERA_MIN_HEIGHT;
+}
+
+// Interval a shorter than b? Unknown (0) intervals lose.
+static int interval_shorter(const CameraMode *a, const CameraMode *b) {
+    if (a->interval_den == 0) return 0;
+    if (b->interval_den == 0) return 1;
+    return (unsigned long long)a->interval_num * b->interval_den <
+           (unsigned long long)b->interval_num * a->interval_den;
+}
+
+// Smallest frame above the floor wins, then the fastest frame rate, then
+// raw YUYV, which is metered over every pixel rather than per 8x8 block.
+// If nothing reaches the floor, take the largest frame on offer.
+static int mode_cheaper(const CameraMode *a, const CameraMode *b) {
+    unsigned long area_a = (unsigned long)a->width * a->height;
+    unsigned long area_b = (unsigned long)b->width * b->height;
+    int fa = meets_floor(a), fb = meets_floor(b);
+
+    if (fa != fb) return fa;
+    if (area_a != area_b) return fa ? area_a < area_b : area_a > area_b;
+    if (interval_shorter(a, b)) return 1;
+    if (interval_shorter(b, a)) return 0;
+    return a->pixelformat == V4L2_PIX_FMT_YUYV && b->pixelformat != V4L2_PIX_FMT_YUYV;
+}
+
+static unsigned int step_up(unsigned int want, unsigned int min, unsigned int max, unsigned int step) {
+    if (want <= min) return min;
+    if (step == 0) step = 1;
+    unsigned int v = min + (want - min + step - 1) / step * step;
+    return v > max ? max : v;
+}
+
+static void fastest_interval(int fd, CameraMode *m) {
+    struct v4l2_frmivalenum iv = {0};
+    iv.pixel_format = m->pixelformat;
+    iv.width = m->width;
+    iv.height = m->height;
+
+    m->interval_num = 0;
+    m->interval_den = 0;
+    for (iv.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &iv) == 0; iv.index++) {
+        CameraMode cand = *m;
+        if (iv.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            cand.interval_num = iv.discrete.numerator;
+            cand.interval_den = iv.discrete.denominator;
+        } else {
+            cand.interval_num = iv.stepwise.min.numerator;
+            cand.interval_den = iv.stepwise.min.denominator;
+        }
+        if (interval_shorter(&cand, m)) *m = cand;
+        if (iv.type != V4L2_FRMIVAL_TYPE_DISCRETE) break;
+    }
+}
+
+int camera_negotiate(const char *dev, CameraMode *mode) {
+    int fd = open(dev, O_RDWR | O_NONBLOCK);
+    if (fd < 0) return -1;
+
+    int found = 0;
+    struct v4l2_fmtdesc fmtdesc = {0};
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    for (fmtdesc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index++) {
+        if (!format_supported(fmtdesc.pixelformat)) continue;
+
+        struct v4l2_frmsizeenum fs = {0};
+        fs.pixel_format = fmtdesc.pixelformat;
+        int sizes = 0;
+
+        for (fs.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fs) == 0; fs.index++) {
+            CameraMode cand = { .pixelformat = fmtdesc.pixelformat };
+            if (fs.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                cand.width = fs.discrete.width;
+                cand.height = fs.discrete.height;
+            } else {
+                cand.width = step_up(CAMERA_MIN_WIDTH, fs.stepwise.min_width, fs.stepwise.max_width, fs.stepwise.step_width);
+                cand.height = step_up(CAMERA_MIN_HEIGHT, fs.stepwise.min_height, fs.stepwise.max_height, fs.stepwise.step_height);
+            }
+            fastest_interval(fd, &cand);
+            sizes++;
+
+            if (!found || mode_cheaper(&cand, mode)) {
+                *mode = cand;
+                found = 1;
+            }
+            if (fs.type != V4L2_FRMSIZE_TYPE_DISCRETE) break;
+        }
+
+        if (sizes == 0 && !found) {
+            // Driver supports the format but not size enumeration
+            mode->pixelformat = fmtdesc.pixelformat;
+            mode->width = CAMERA_FALLBACK_WIDTH;
+            mode->height = CAMERA_FALLBACK_HEIGHT;
+            mode->interval_num = mode->interval_den = 0;
+            found = 1;
+        }
+    }
+    close(fd);
+
+    return found ? 0 : -1;
+}
+
+const CameraMode *camera_mode_cached(const char *dev) {
+    for (int i = 0; i < mode_cache_len; i++) {
+        if (strcmp(mode_cache[i].dev, dev) == 0) return &mode_cache[i].mode;
+    }
+    return NULL;
+}
+
+const CameraMode *camera_mode_lookup(const char *dev) {
+    const CameraMode *cached = camera_mode_cached(dev);
+    if (cached) return cached;
+
+    CameraMode mode;
+    if (camera_negotiate(dev, &mode) < 0) return NULL;
+
+    // Oldest entry makes way once the cache is full
+    int slot = mode_cache_len;
+    if (slot == CAMERA_MODE_CACHE) {
+        memmove(&mode_cache[0], &mode_cache[1], sizeof(mode_cache[0]) * (CAMERA_MODE_CACHE - 1));
+        slot = CAMERA_MODE_CACHE - 1;
+    }
+    memset(mode_cache[slot].dev, 0, sizeof(mode_cache[slot].dev));
+    strncpy(mode_cache[slot].dev, dev, sizeof(mode_cache[slot].dev) - 1);
+    mode_cache[slot].mode = mode;
+    if (mode_cache_len < CAMERA_MODE_CACHE) mode_cache_len++;
+
+    if (verbose) {
+        char desc[64];
+        camera_mode_describe(&mode, desc, sizeof(desc));
+        printf("Camera %s: using %s\n", dev, desc);
+    }
+    return &mode_cache[slot].mode;
+}
+
+void camera_mode_describe(const CameraMode *mode, char *buf, size_t len) {
+    char fourcc[5] = {
+        mode->pixelformat & 0xFF, (mode->pixelformat >> 8) & 0xFF,
+        (mode->pixelformat >> 16) & 0xFF, (mode->pixelformat >> 24) & 0xFF, 0
+    };
+    if (mode->interval_num) {
+        snprintf(buf, len, "%s:%ux%u@%.4gfps", fourcc, mode->width, mode->height,
+                 (double)mode->interval_den / mode->interval_num);
+    } else {
+        snprintf(buf, len, "%s:%ux%u", fourcc, mode->width, mode->height);
+    }
+}
+
+void camera_init(CameraSession *cam) {
+    memset(cam, 0, sizeof(*cam));
+    cam->fd = -1;
+}
+
+int camera_is_open(const CameraSession *cam) {
+    return cam->fd >= 0 && cam->streaming;
+}
+
+int camera_open(CameraSession *cam, const char *dev, const CameraMode *mode) {
+    camera_init(cam);
+
+    // Non-blocking: frames are picked up when the event loop sees the fd readable
+    uint64_t t0 = stats_now();
+    cam->fd = open(dev, O_RDWR | O_NONBLOCK);
+    if (cam->fd < 0) {
+        if (verbose) perror("Camera open failed");
+        return -1;
+    }
+    stats_record(STAGE_CAMERA_OPEN, t0);
+    strncpy(cam->dev, dev, sizeof(cam->dev) - 1);
+
+    struct v4l2_format fmt = {0};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = mode->width;
+    fmt.fmt.pix.height = mode->height;
+    fmt.fmt.pix.pixelformat = mode->pixelformat;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    t0 = stats_now();
+    if (xioctl(cam->fd, VIDIOC_S_FMT, &fmt) == -1) {
+        camera_close(cam);
+        return -1;
+    }
+    // The driver may silently substitute another format
+    if (fmt.fmt.pix.pixelformat != mode->pixelformat) {
+        if (verbose) fprintf(stderr, "Camera %s refused the negotiated pixel format\n", dev);
+        camera_close(cam);
+        return -1;
+    }
+    cam->mode.pixelformat = fmt.fmt.pix.pixelformat;
+    cam->mode.width = fmt.fmt.pix.width;
+    cam->mode.height = fmt.fmt.pix.height;
+    cam->bytesperline = fmt.fmt.pix.bytesperline;
+
+    if (mode->interval_num) {
+        struct v4l2_streamparm parm = {0};
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(cam->fd, VIDIOC_G_PARM, &parm) == 0 &&
+            (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+            parm.parm.capture.timeperframe.numerator = mode->interval_num;
+            parm.parm.capture.timeperframe.denominator = mode->interval_den;
+            if (xioctl(cam->fd, VIDIOC_S_PARM, &parm) == 0) {
+                cam->mode.interval_num = parm.parm.capture.timeperframe.numerator;
+                cam->mode.interval_den = parm.parm.capture.timeperframe.denominator;
+            }
+        }
+    }
+
+    stats_record(STAGE_FORMAT_SET, t0);
+
+    t0 = stats_now();
+    struct v4l2_requestbuffers req = {0};
+    req.count = CAMERA_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(cam->fd, VIDIOC_REQBUFS, &req) == -1 || req.count == 0) {
+        camera_close(cam);
+        return -1;
+    }
+    if (req.count > CAMERA_BUFFERS) req.count = CAMERA_BUFFERS;
+
+    for (unsigned int i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf = {0};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(cam->fd, VIDIOC_QUERYBUF, &buf) == -1) {
+            camera_close(cam);
+            return -1;
+        }
+
+        void *start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, cam->fd, buf.m.offset);
+        if (start == MAP_FAILED) {
+            camera_close(cam);
+            return -1;
+        }
+        cam->buffers[i].start = start;
+        cam->buffers[i].length = buf.length;
+        cam->n_buffers++;
+
+        if (xioctl(cam->fd, VIDIOC_QBUF, &buf) == -1) {
+            camera_close(cam);
+            return -1;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(cam->fd, VIDIOC_STREAMON, &type) == -1) {
+        camera_close(cam);
+        return -1;
+    }
+    cam->streaming = 1;
+    stats_record(STAGE_STREAM_ON, t0);
+    camera_touch(cam);
+
+    if (verbose) {
+        char desc[64];
+        camera_mode_describe(&cam->mode, desc, sizeof(desc));
+        printf("Camera %s streaming %s (%u buffers)\n", cam->dev, desc, cam->n_buffers);
+    }
+    return 0;
+}
+
+static int ctrl_get(int fd, unsigned int id, int *value) {
+    struct v4l2_control c = { .id = id };
+    if (xioctl(fd, VIDIOC_G_CTRL, &c) == -1) return -1;
+    *value = c.value;
+    return 0;
+}
+
+static int ctrl_set(int fd, unsigned int id, int value) {
+    struct v4l2_control c = { .id = id, .value = value };
+    return xioctl(fd, VIDIOC_S_CTRL, &c);
+}
+
+static int ctrl_query(int fd, unsigned int id, struct v4l2_queryctrl *q) {
+    memset(q, 0, sizeof(*q));
+    q->id = id;
+    if (xioctl(fd, VIDIOC_QUERYCTRL, q) == -1) return -1;
+    return (q->flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY)) ? -1 : 0;
+}
+
+int camera_exposure_lock(CameraSession *cam, long start) {
+    CameraExposure *e = &cam->exposure;
+    if (e->locked) return 0;
+
+    struct v4l2_queryctrl q;
+    int saved_auto;
+    if (ctrl_query(cam->fd, V4L2_CID_EXPOSURE_ABSOLUTE, &q) == -1) return -1;
+    if (ctrl_get(cam->fd, V4L2_CID_EXPOSURE_AUTO, &saved_auto) == -1) return -1;
+
+    e->ref = q.default_value;
+    e->min = q.minimum;
+    e->max = q.maximum;
+    e->saved_auto = saved_auto;
+    e->saved_autogain = -1;
+    e->has_gain = 0;
+
+    if (ctrl_set(cam->fd, V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL) == -1) return -1;
+    e->locked = 1;
+
+    // Fixed gain keeps the exposure ratio the only scale factor
+    int autogain;
+    if (ctrl_get(cam->fd, V4L2_CID_AUTOGAIN, &autogain) == 0 &&
+        ctrl_set(cam->fd, V4L2_CID_AUTOGAIN, 0) == 0) {
+        e->saved_autogain = autogain;
+    }
+    struct v4l2_queryctrl gq;
+    int gain;
+    if (ctrl_query(cam->fd, V4L2_CID_GAIN, &gq) == 0 && ctrl_get(cam->fd, V4L2_CID_GAIN, &gain) == 0 &&
+        ctrl_set(cam->fd, V4L2_CID_GAIN, gq.default_value) == 0) {
+        e->saved_gain = gain;
+        e->has_gain = 1;
+    }
+
+    if (camera_exposure_set(cam, start > 0 ? start : e->ref) == -1) {
+        camera_exposure_unlock(cam); // Don't leave auto exposure off behind a failed lock
+        return -1;
+    }
+    if (verbose) printf("Camera %s: exposure locked at %ld (ref %ld)\n", cam->dev, e->value, e->ref);
+    return 0;
+}
+
+int camera_exposure_set(CameraSession *cam, long value) {
+    CameraExposure *e = &cam->exposure;
+    if (value < e->min) value = e->min;
+    if (value > e->max) value = e->max;
+    if (ctrl_set(cam->fd, V4L2_CID_EXPOSURE_ABSOLUTE, (int)value) == -1) return -1;
+    e->value = value;
+    return 0;
+}
+
+void camera_exposure_unlock(CameraSession *cam) {
+    CameraExposure *e = &cam->exposure;
+    if (!e->locked) return;
+    if (e->has_gain) ctrl_set(cam->fd, V4L2_CID_GAIN, e->saved_gain);
+    if (e->saved_autogain >= 0) ctrl_set(cam->fd, V4L2_CID_AUTOGAIN, e->saved_autogain);
+    ctrl_set(cam->fd, V4L2_CID_EXPOSURE_AUTO, e->saved_auto);
+    e->locked = 0;
+}
+
+void camera_close(CameraSession *cam) {
+    if (cam->fd < 0) return;
+    int saved_errno = errno; // Callers check why the open that led here failed (EBUSY)
+
+    camera_exposure_unlock(cam);
+
+    if (cam->streaming) {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(cam->fd, VIDIOC_STREAMOFF, &type);
+    }
+    for (unsigned int i = 0; i < cam->n_buffers; i++) {
+        munmap(cam->buffers[i].start, cam->buffers[i].length);
+    }
+    close(cam->fd);
+    if (verbose && cam->streaming) printf("Camera %s closed\n", cam->dev);
+    camera_init(cam);
+    errno = saved_errno;
+}
+
+static int dequeue_one(CameraSession *cam, CameraFrame *frame) {
+    struct v4l2_buffer buf = {0};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(cam->fd, VIDIOC_DQBUF, &buf) == -1) return -1;
+    if (buf.index >= cam->n_buffers) return -1;
+
+    frame->index = buf.index;
+    frame->data = cam->buffers[buf.index].start;
+    frame->bytesused = buf.bytesused;
+    return 0;
+}
+
+void camera_flush(CameraSession *cam) {
+    CameraFrame frame;
+    while (dequeue_one(cam, &frame) == 0) {
+        camera_requeue(cam, &frame);
+    }
+}
+
+int camera_dequeue(CameraSession *cam, CameraFrame *frame) {
+    if (dequeue_one(cam, frame) == 0) return 1;
+    return errno == EAGAIN ? 0 : -1;
+}
+
+void camera_requeue(CameraSession *cam, const CameraFrame *frame) {
+    struct v4l2_buffer buf = {0};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = frame->index;
+    xioctl(cam->fd, VIDIOC_QBUF, &buf);
+}
+
+void camera_touch(CameraSession *cam) {
+    clock_gettime(CLOCK_MONOTONIC, &cam->last_used);
+}
+
+double camera_idle_seconds(const CameraSession *cam) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - cam->last_used.tv_sec) + (now.tv_nsec - cam->last_used.tv_nsec) / 1e9;
+}
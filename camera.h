@@ -0,0 +1,93 @@
+/*
+ * Lumos: V4L2 capture session
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_CAMERA_H
+#define LUMOS_CAMERA_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define CAMERA_BUFFERS 4
+
+typedef struct {
+    void *start;
+    size_t length;
+} CameraBuffer;
+
+// Capture mode picked once per device by camera_negotiate()
+typedef struct {
+    unsigned int pixelformat;
+    unsigned int width;
+    unsigned int height;
+    unsigned int interval_num; // Frame interval in seconds (num/den), 0 if unknown
+    unsigned int interval_den;
+} CameraMode;
+
+// Manual exposure state. Whatever auto settings we override are put back
+// on close so a video call opened afterwards doesn't inherit them.
+typedef struct {
+    int locked;
+    int has_gain;
+    int saved_auto;     // V4L2_CID_EXPOSURE_AUTO before locking
+    int saved_autogain; // V4L2_CID_AUTOGAIN before locking, -1 if absent
+    int saved_gain;     // V4L2_CID_GAIN before locking, if has_gain
+    long value;         // Current V4L2_CID_EXPOSURE_ABSOLUTE
+    long ref;           // Driver default; estimates are scaled to this
+    long min;
+    long max;
+} CameraExposure;
+
+// A long-lived streaming handle. The mmap ring stays queued between samples
+// so the next capture only has to wait for a fresh frame.
+typedef struct {
+    int fd;
+    char dev[64];
+    CameraBuffer buffers[CAMERA_BUFFERS];
+    unsigned int n_buffers;
+    CameraMode mode; // What the driver actually accepted
+    unsigned int bytesperline;
+    int streaming;
+    CameraExposure exposure;
+    struct timespec last_used; // CLOCK_MONOTONIC
+} CameraSession;
+
+typedef struct {
+    const unsigned char *data;
+    size_t bytesused;
+    unsigned int index;
+} CameraFrame;
+
+void camera_init(CameraSession *cam);
+// Enumerates formats, frame sizes and intervals and picks the cheapest usable mode
+int camera_negotiate(const char *dev, CameraMode *mode);
+// Cached per device; negotiates on first use. NULL if the device can't be probed.
+const CameraMode *camera_mode_lookup(const char *dev);
+// Cache lookup only, never touches the device
+const CameraMode *camera_mode_cached(const char *dev);
+void camera_mode_describe(const CameraMode *mode, char *buf, size_t len);
+
+int camera_open(CameraSession *cam, const char *dev, const CameraMode *mode);
+void camera_close(CameraSession *cam);
+int camera_is_open(const CameraSession *cam);
+
+// Drops every frame the driver filled while we were not looking.
+void camera_flush(CameraSession *cam);
+// Takes the next filled buffer without blocking: 1 = frame, 0 = none yet, -1 = error.
+// The buffer must be handed back with camera_requeue().
+int camera_dequeue(CameraSession *cam, CameraFrame *frame);
+void camera_requeue(CameraSession *cam, const CameraFrame *frame);
+
+// Switch to manual exposure at `start` (driver default if 0).
+// Fails if the driver has no V4L2_CID_EXPOSURE_ABSOLUTE.
+int camera_exposure_lock(CameraSession *cam, long start);
+int camera_exposure_set(CameraSession *cam, long value);
+// Hands exposure back to the driver's saved auto settings
+void camera_exposure_unlock(CameraSession *cam);
+
+void camera_touch(CameraSession *cam);
+double camera_idle_seconds(const CameraSession *cam);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Lumos: configuration snapshots
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "display.h"
+
+extern int verbose;
+
+const char *config_keys[] = {
+    "mode", "manual_brightness", "min_brightness", "max_brightness", "interval", "interval_min",
+    "brighten_threshold", "dim_threshold", "learn_window", "brightness_offset", "sensitivity", "camera_dev",
+    "light_source", "als_dev", "als_interval_ms", "als_gain", "stream_idle", "exposure_lock",
+    "ramp_ms", "ramp_hz", "displays", "stats_file", NULL
+};
+
+static const Config defaults = {
+    .min_brightness = 5,
+    .max_brightness = 100,
+    .interval = 60,
+    .interval_min = 2,
+    .brightness_offset = 0,
+    .sensitivity = 1.0f,
+    .mode = 0,
+    .manual_brightness = 50,
+    .camera_dev = "/dev/video0",
+    .light_source = LIGHT_AUTO,
+    .als_dev = "auto",
+    .als_interval_ms = 500,
+    .als_gain = 1.0f,
+    .stream_idle = 0,
+    .exposure_lock = 0,
+    .ramp_ms = 300,
+    .ramp_hz = 60,
+    .brighten_threshold = 4,
+    .dim_threshold = 6,
+    .learn_window = 30,
+    .displays = "backlight",
+    .version = 1
+};
+
+static Config initial = defaults;
+static _Atomic(Config *) current = &initial;
+
+void config_defaults(Config *c) {
+    *c = defaults;
+}
+
+// Whole-string integer in [lo, hi]
+static int parse_int(const char *s, int lo, int hi, int *out) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (errno || end == s || *end != '\0' || v < lo || v > hi) return -1;
+    *out = (int)v;
+    return 0;
+}
+
+int config_set(Config *c, const char *key, const char *val) {
+    int v;
+
+    if (strcmp(key, "min_brightness") == 0) {
+        if (parse_int(val, 0, 100, &v) < 0) return -2;
+        c->min_brightness = v;
+    } else if (strcmp(key, "max_brightness") == 0) {
+        if (parse_int(val, 0, 100, &v) < 0) return -2;
+        c->max_brightness = v;
+    } else if (strcmp(key, "interval") == 0) {
+        if (parse_int(val, 1, 86400, &v) < 0) return -2;
+        c->interval = v;
+    } else if (strcmp(key, "interval_min") == 0) {
+        if (parse_int(val, 1, 86400, &v) < 0) return -2;
+        c->interval_min = v;
+    } else if (strcmp(key, "brighten_threshold") == 0) {
+        if (parse_int(val, 0, 100, &v) < 0) return -2;
+        c->brighten_threshold = v;
+    } else if (strcmp(key, "dim_threshold") == 0) {
+        if (parse_int(val, 0, 100, &v) < 0) return -2;
+        c->dim_threshold = v;
+    } else if (strcmp(key, "learn_window") == 0) {
+        if (parse_int(val, 0, 3600, &v) < 0) return -2;
+        c->learn_window = v;
+    } else if (strcmp(key, "brightness_offset") == 0) {
+        if (parse_int(val, -100, 100, &v) < 0) return -2;
+        c->brightness_offset = v;
+    } else if (strcmp(key, "sensitivity") == 0) {
+        char *end;
+        float f = roundf(strtof(val, &end) * 100.0f) / 100.0f; // As saved, so a reload changes nothing
+        if (end == val || *end != '\0' || !(f > 0.0f && f <= 10.0f)) return -2;
+        c->sensitivity = f;
+    } else if (strcmp(key, "mode") == 0) {
+        if (strcmp(val, "manual") == 0 || strcmp(val, "1") == 0) c->mode = 1;
+        else if (strcmp(val, "auto") == 0 || strcmp(val, "0") == 0) c->mode = 0;
+        else return -2;
+    } else if (strcmp(key, "manual_brightness") == 0) {
+        if (parse_int(val, 0, 100, &v) < 0) return -2;
+        c->manual_brightness = v;
+    } else if (strcmp(key, "camera_dev") == 0) {
+        if (val[0] == '\0' || strlen(val) >= sizeof(c->camera_dev)) return -2;
+        strcpy(c->camera_dev, val);
+    } else if (strcmp(key, "light_source") == 0) {
+        if (strcmp(val, "auto") == 0) c->light_source = LIGHT_AUTO;
+        else if (strcmp(val, "camera") == 0) c->light_source = LIGHT_CAMERA;
+        else if (strcmp(val, "als") == 0) c->light_source = LIGHT_ALS;
+        else return -2;
+    } else if (strcmp(key, "als_dev") == 0) {
+        if (val[0] == '\0' || strlen(val) >= sizeof(c->als_dev)) return -2;
+        strcpy(c->als_dev, val);
+    } else if (strcmp(key, "als_interval_ms") == 0) {
+        if (parse_int(val, 50, 60000, &v) < 0) return -2;
+        c->als_interval_ms = v;
+    } else if (strcmp(key, "als_gain") == 0) {
+        char *end;
+        float f = roundf(strtof(val, &end) * 1000.0f) / 1000.0f;
+        if (end == val || *end != '\0' || !(f >= 0.01f && f <= 100.0f)) return -2;
+        c->als_gain = f;
+    } else if (strcmp(key, "stream_idle") == 0) {
+        if (parse_int(val, 0, 86400, &v) < 0) return -2;
+        c->stream_idle = v;
+    } else if (strcmp(key, "exposure_lock") == 0) {
+        if (parse_int(val, 0, 1, &v) < 0) return -2;
+        c->exposure_lock = v;
+    } else if (strcmp(key, "ramp_ms") == 0) {
+        if (parse_int(val, 0, 60000, &v) < 0) return -2;
+        c->ramp_ms = v;
+    } else if (strcmp(key, "ramp_hz") == 0) {
+        if (parse_int(val, 1, 1000, &v) < 0) return -2;
+        c->ramp_hz = v;
+    } else if (strcmp(key, "displays") == 0) {
+        if (strlen(val) >= sizeof(c->displays) || display_list_check(val) < 0) return -2;
+        strcpy(c->displays, val);
+    } else if (strcmp(key, "stats_file") == 0) {
+        if (strcmp(val, "none") == 0) val = "";
+        else if (val[0] != '/' || strlen(val) >= sizeof(c->stats_file) - 4) return -2; // Room for ".tmp"
+        strcpy(c->stats_file, val);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int config_format(const Config *c, const char *key, char *buf, size_t len) {
+    if (strcmp(key, "min_brightness") == 0) snprintf(buf, len, "%d", c->min_brightness);
+    else if (strcmp(key, "max_brightness") == 0) snprintf(buf, len, "%d", c->max_brightness);
+    else if (strcmp(key, "interval") == 0) snprintf(buf, len, "%d", c->interval);
+    else if (strcmp(key, "interval_min") == 0) snprintf(buf, len, "%d", c->interval_min);
+    else if (strcmp(key, "brighten_threshold") == 0) snprintf(buf, len, "%d", c->brighten_threshold);
+    else if (strcmp(key, "dim_threshold") == 0) snprintf(buf, len, "%d", c->dim_threshold);
+    else if (strcmp(key, "learn_window") == 0) snprintf(buf, len, "%d", c->learn_window);
+    else if (strcmp(key, "brightness_offset") == 0) snprintf(buf, len, "%d", c->brightness_offset);
+    else if (strcmp(key, "sensitivity") == 0) snprintf(buf, len, "%.2f", c->sensitivity);
+    else if (strcmp(key, "mode") == 0) snprintf(buf, len, "%s", c->mode ? "manual" : "auto");
+    else if (strcmp(key, "manual_brightness") == 0) snprintf(buf, len, "%d", c->manual_brightness);
+    else if (strcmp(key, "camera_dev") == 0) snprintf(buf, len, "%s", c->camera_dev);
+    else if (strcmp(key, "light_source") == 0)
+        snprintf(buf, len, "%s", c->light_source == LIGHT_ALS ? "als" : c->light_source == LIGHT_CAMERA ? "camera" : "auto");
+    else if (strcmp(key, "als_dev") == 0) snprintf(buf, len, "%s", c->als_dev);
+    else if (strcmp(key, "als_interval_ms") == 0) snprintf(buf, len, "%d", c->als_interval_ms);
+    else if (strcmp(key, "als_gain") == 0) snprintf(buf, len, "%.3f", c->als_gain);
+    else if (strcmp(key, "stream_idle") == 0) snprintf(buf, len, "%d", c->stream_idle);
+    else if (strcmp(key, "exposure_lock") == 0) snprintf(buf, len, "%d", c->exposure_lock);
+    else if (strcmp(key, "ramp_ms") == 0) snprintf(buf, len, "%d", c->ramp_ms);
+    else if (strcmp(key, "ramp_hz") == 0) snprintf(buf, len, "%d", c->ramp_hz);
+    else if (strcmp(key, "displays") == 0) snprintf(buf, len, "%s", c->displays);
+    else if (strcmp(key, "stats_file") == 0) snprintf(buf, len, "%s", c->stats_file[0] ? c->stats_file : "none");
+    else return -1;
+    return 0;
+}
+
+int config_check(const Config *c) {
+    return c->min_brightness < c->max_brightness ? 0 : -1;
+}
+
+unsigned config_diff(const Config *a, const Config *b) {
+    unsigned changed = 0;
+    if (a->min_brightness != b->min_brightness || a->max_brightness != b->max_brightness ||
+        a->brightness_offset != b->brightness_offset || a->sensitivity != b->sensitivity ||
+        a->manual_brightness != b->manual_brightness || a->brighten_threshold != b->brighten_threshold ||
+        a->dim_threshold != b->dim_threshold || a->learn_window != b->learn_window)
+        changed |= CONFIG_CURVE;
+    if (a->mode != b->mode) changed |= CONFIG_MODE;
+    if (strcmp(a->camera_dev, b->camera_dev) != 0 || a->exposure_lock != b->exposure_lock ||
+        a->light_source != b->light_source || strcmp(a->als_dev, b->als_dev) != 0 || a->als_gain != b->als_gain)
+        changed |= CONFIG_CAPTURE;
+    if (a->interval != b->interval || a->interval_min != b->interval_min || a->stream_idle != b->stream_idle ||
+        a->als_interval_ms != b->als_interval_ms)
+        changed |= CONFIG_TIMING;
+    if (a->ramp_ms != b->ramp_ms || a->ramp_hz != b->ramp_hz) changed |= CONFIG_RAMP;
+    if (strcmp(a->stats_file, b->stats_file) != 0) changed |= CONFIG_EXPORT;
+    if (strcmp(a->displays, b->displays) != 0) changed |= CONFIG_DISPLAYS;
+    return changed;
+}
+
+const Config *config_get(void) {
+    return atomic_load_explicit(&current, memory_order_acquire);
+}
+
+unsigned config_commit(const Config *next) {
+    Config *old = atomic_load_explicit(&current, memory_order_acquire);
+    unsigned changed = config_diff(old, next);
+    if (!changed) return 0;
+
+    Config *snap = malloc(sizeof(*snap));
+    if (!snap) return 0;
+    *snap = *next;
+    snap->version = old->version + 1;
+    atomic_store_explicit(&current, snap, memory_order_release);
+
+    // Every reader runs on the daemon's one thread and none keeps a
+    // snapshot across an update, so the old one can go right away
+    if (old != &initial) free(old);
+    return changed;
+}
+
+int config_load(const char *path, Config *c) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        char key[128], val[256];
+        if (sscanf(line, "%127[^=]=%255s", key, val) != 2) continue;
+        int rc = config_set(c, key, val);
+        if (rc == -2 && verbose) fprintf(stderr, "Ignoring invalid %s=%s in %s\n", key, val, path);
+    }
+    fclose(f);
+    return 0;
+}
+
+void config_sibling(const char *config_path, const char *ext, char *buf, size_t len) {
+    size_t n = strlen(config_path);
+    if (n > 5 && strcmp(config_path + n - 5, ".conf") == 0) n -= 5;
+    snprintf(buf, len, "%.*s.%s", (int)n, config_path, ext);
+}
+
+// The directory entry from a rename is only durable once the directory is synced
+static void sync_dir(const char *path) {
+    char dir[512];
+    const char *slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path) + (slash == path), path);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+int config_save(const char *path, const Config *c) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+
+    fprintf(f, "# Lumos Configuration File\n\n");
+    fprintf(f, "# Minimum brightness percentage (0-100)\n");
+    fprintf(f, "min_brightness=%d\n\n", c->min_brightness);
+    fprintf(f, "# Maximum brightness percentage (0-100)\n");
+    fprintf(f, "max_brightness=%d\n\n", c->max_brightness);
+    fprintf(f, "# Longest gap between samples in steady light, in seconds\n");
+    fprintf(f, "interval=%d\n\n", c->interval);
+    fprintf(f, "# Gap between samples while the light is changing, in seconds\n");
+    fprintf(f, "interval_min=%d\n\n", c->interval_min);
+    fprintf(f, "# Brightness Offset (Default: 0)\n");
+    fprintf(f, "brightness_offset=%d\n\n", c->brightness_offset);
+    fprintf(f, "# Change needed before following the light up / down (percent)\n");
+    fprintf(f, "brighten_threshold=%d\n", c->brighten_threshold);
+    fprintf(f, "dim_threshold=%d\n\n", c->dim_threshold);
+    fprintf(f, "# Seconds after an auto reading in which a manual change teaches the curve (0=off)\n");
+    fprintf(f, "learn_window=%d\n\n", c->learn_window);
+    fprintf(f, "# Brightness Sensitivity (Default: 1.0)\n");
+    fprintf(f, "sensitivity=%.2f\n\n", c->sensitivity);
+    fprintf(f, "# Mode (auto/manual)\n");
+    fprintf(f, "mode=%s\n\n", c->mode ? "manual" : "auto");
+    fprintf(f, "# Manual Brightness Value (0-100)\n");
+    fprintf(f, "manual_brightness=%d\n\n", c->manual_brightness);
+    fprintf(f, "# Camera Device (e.g. /dev/video0)\n");
+    fprintf(f, "camera_dev=%s\n\n", c->camera_dev);
+    fprintf(f, "# Light source: auto (ALS if present, else camera), camera or als\n");
+    fprintf(f, "light_source=%s\n", c->light_source == LIGHT_ALS ? "als" : c->light_source == LIGHT_CAMERA ? "camera" : "auto");
+    fprintf(f, "# IIO ambient light sensor (auto or a /sys/bus/iio/devices/iio:deviceN directory)\n");
+    fprintf(f, "als_dev=%s\n", c->als_dev);
+    fprintf(f, "# Sample period while using the ALS, in ms, and its lux-to-luma gain (set by CALIBRATE)\n");
+    fprintf(f, "als_interval_ms=%d\n", c->als_interval_ms);
+    fprintf(f, "als_gain=%.3f\n\n", c->als_gain);
+    fprintf(f, "# Keep the camera streaming for this many idle seconds (0=close after each sample)\n");
+    fprintf(f, "stream_idle=%d\n\n", c->stream_idle);
+    fprintf(f, "# Meter at a locked exposure when the camera supports it (0/1)\n");
+    fprintf(f, "exposure_lock=%d\n\n", c->exposure_lock);
+    fprintf(f, "# Brightness fade duration in ms (0=instant) and update rate in Hz\n");
+    fprintf(f, "ramp_ms=%d\n", c->ramp_ms);
+    fprintf(f, "ramp_hz=%d\n\n", c->ramp_hz);
+    fprintf(f, "# Displays to drive: backlight, ddc, sysfs:DIR, ddc:/dev/i2c-N, fake:NAME[/MS],\n");
+    fprintf(f, "# comma-separated, each optionally with a curve @LO-HI[^GAMMA]\n");
+    fprintf(f, "displays=%s\n\n", c->displays);
+    fprintf(f, "# Prometheus node-exporter textfile for latency stats (none=off)\n");
+    fprintf(f, "stats_file=%s\n", c->stats_file[0] ? c->stats_file : "none");
+
+    // A crash leaves either the old file or the new one, never half of each
+    int ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        int saved_errno = errno;
+        remove(tmp);
+        errno = saved_errno;
+        return -1;
+    }
+    sync_dir(path);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Lumos: configuration snapshots
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_CONFIG_H
+#define LUMOS_CONFIG_H
+
+#include <stddef.h>
+
+typedef struct {
+    int min_brightness;
+    int max_brightness;
+    int interval; // Longest gap between samples while the light is steady
+    int interval_min; // Gap while it is changing
+    int brightness_offset;
+    float sensitivity;
+    int mode; // 0=Auto, 1=Manual
+    int manual_brightness;
+    char camera_dev[64];
+    int light_source; // LIGHT_AUTO, LIGHT_CAMERA or LIGHT_ALS
+    char als_dev[128]; // IIO device directory, or "auto" to find one
+    int als_interval_ms; // Sample period while reading the ALS
+    float als_gain; // Lux-to-luma calibration against the camera
+    int stream_idle; // Seconds to keep the camera streaming between samples (0=close after each)
+    int exposure_lock; // Meter at a fixed exposure instead of waiting for auto-exposure
+    int ramp_ms; // Fade duration for brightness changes (0=jump)
+    int ramp_hz; // Fade update rate
+    int brighten_threshold; // Percent the target must rise before we follow
+    int dim_threshold; // ...or fall; higher, since dimming is more noticeable
+    int learn_window; // Seconds after an auto reading a manual change trains the curve (0=off)
+    char displays[256]; // Devices to drive, with optional per-device curves (see display.h)
+    char stats_file[256]; // node-exporter textfile to keep updated (empty=off)
+    unsigned long version; // Bumped by every committed change
+} Config;
+
+#define LIGHT_AUTO 0   // The ALS when there is one, else the camera
+#define LIGHT_CAMERA 1
+#define LIGHT_ALS 2
+
+// What a change touches, so the loop only redoes the work it has to
+#define CONFIG_CURVE   (1u << 0)  // Ambient-to-brightness mapping; the last reading still applies
+#define CONFIG_MODE    (1u << 1)
+#define CONFIG_CAPTURE (1u << 2)  // Camera or metering; needs a fresh sample
+#define CONFIG_TIMING  (1u << 3)  // Sample interval or keep-alive
+#define CONFIG_RAMP    (1u << 4)
+#define CONFIG_EXPORT  (1u << 5)
+#define CONFIG_DISPLAYS (1u << 6) // Device set or curves; the registry is reopened
+
+// Keys config_set() and config_format() understand, NULL-terminated
+extern const char *config_keys[];
+
+void config_defaults(Config *c);
+
+// Parses and range-checks one value into c; -1 for an unknown key,
+// -2 for a bad value (c is left untouched either way)
+int config_set(Config *c, const char *key, const char *val);
+// Formats one value; -1 for an unknown key
+int config_format(const Config *c, const char *key, char *buf, size_t len);
+// Checks constraints between fields; -1 if the combination is unusable
+int config_check(const Config *c);
+unsigned config_diff(const Config *a, const Config *b);
+
+// The current snapshot. It is never modified in place; changes are made on
+// a copy and swapped in whole by config_commit().
+const Config *config_get(void);
+// Publishes next as the new snapshot; returns what changed (0 = nothing, no new version)
+unsigned config_commit(const Config *next);
+
+// State kept beside the config file: (lumos.conf, "curve") -> lumos.curve
+void config_sibling(const char *config_path, const char *ext, char *buf, size_t len);
+
+// Applies the keys found in path on top of c; -1 if it can't be read
+int config_load(const char *path, Config *c);
+int config_save(const char *path, const Config *c);
+
+#endif
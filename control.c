@@ -0,0 +1,83 @@
+/*
+ * Lumos: brightness decisions
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <math.h>
+
+#include "control.h"
+
+#define MEASUREMENT_NOISE 4.0   // Variance of one reading, luma^2
+#define PROCESS_NOISE 2.0       // Drift of real light per second, luma^2/s
+#define MOVING_LUMA 3.0         // Innovation that counts as the light changing
+#define STEP_LUMA 20.0          // ...and as a step when also outside 3 sigma
+
+double control_base_percent(const Config *cfg, double luma) {
+    double percent = luma / 180.0 * 100.0;
+    percent *= cfg->sensitivity;
+    percent += cfg->brightness_offset;
+    return percent;
+}
+
+double control_auto_percent(const Config *cfg, const Curve *curve, double luma) {
+    double percent = curve_lookup(curve, luma);
+    if (percent < cfg->min_brightness) percent = cfg->min_brightness;
+    if (percent > cfg->max_brightness) percent = cfg->max_brightness;
+    return percent;
+}
+
+int control_level(double percent, int max_level) {
+    return (int)((percent / 100.0) * max_level);
+}
+
+int control_should_move(const Config *cfg, int current, int target, int max_level) {
+    if (max_level <= 0) return 0;
+    double delta = (target - current) * 100.0 / max_level;
+    return delta > cfg->brighten_threshold || -delta > cfg->dim_threshold;
+}
+
+void tracker_reset(Tracker *t) {
+    t->primed = 0;
+    t->estimate = 0.0;
+    t->variance = 0.0;
+    t->last_time = 0.0;
+    t->interval = 0.0;
+    t->moving = 1;
+}
+
+void tracker_update(Tracker *t, const Config *cfg, double luma, double now) {
+    if (!t->primed) {
+        t->primed = 1;
+        t->estimate = luma;
+        t->variance = MEASUREMENT_NOISE;
+        t->moving = 1;
+    } else {
+        double dt = now - t->last_time;
+        if (dt < 0.0) dt = 0.0;
+
+        double predicted = t->variance + PROCESS_NOISE * dt;
+        double innovation = luma - t->estimate;
+        double sigma = sqrt(predicted + MEASUREMENT_NOISE);
+
+        if (fabs(innovation) > STEP_LUMA && fabs(innovation) > 3.0 * sigma) {
+            t->estimate = luma;
+            t->variance = MEASUREMENT_NOISE;
+        } else {
+            double gain = predicted / (predicted + MEASUREMENT_NOISE);
+            t->estimate += gain * innovation;
+            t->variance = (1.0 - gain) * predicted;
+        }
+        t->moving = fabs(innovation) > MOVING_LUMA;
+    }
+    t->last_time = now;
+    t->interval = t->moving ? cfg->interval_min : t->interval * 2.0;
+    t->interval = tracker_interval(t, cfg);
+}
+
+double tracker_interval(const Tracker *t, const Config *cfg) {
+    double lo = cfg->interval_min < cfg->interval ? cfg->interval_min : cfg->interval;
+    if (t->interval < lo) return lo;
+    if (t->interval > cfg->interval) return cfg->interval;
+    return t->interval;
+}
@@ -0,0 +1,43 @@
+/*
+ * Lumos: brightness decisions
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_CONTROL_H
+#define LUMOS_CONTROL_H
+
+#include "config.h"
+#include "curve.h"
+
+// The built-in mapping, luma / 180 * 100 * sensitivity + offset, unclamped
+double control_base_percent(const Config *cfg, double luma);
+// Ambient luma (0-255) to a backlight percentage through the compiled curve,
+// within the configured range
+double control_auto_percent(const Config *cfg, const Curve *curve, double luma);
+// Percentage to a hardware level on a 0..max_level scale
+int control_level(double percent, int max_level);
+// Hysteresis: move only when brightening by more than brighten_threshold
+// or dimming by more than dim_threshold percent of the range
+int control_should_move(const Config *cfg, int current, int target, int max_level);
+
+// Smooths readings (scalar Kalman filter) and decides how soon to look again
+typedef struct {
+    int primed;
+    double estimate;   // Filtered luma
+    double variance;   // Uncertainty of the estimate, luma^2
+    double last_time;  // When the last reading was folded in, seconds
+    double interval;   // Seconds until the next sample
+    int moving;        // The last reading showed the light changing
+} Tracker;
+
+void tracker_reset(Tracker *t);
+// Folds a reading taken at `now` (seconds on any monotonic clock) into the
+// estimate. A jump well outside the expected noise is taken as a step (a lamp
+// switched on) and adopted at once. The interval drops to interval_min while
+// the light is moving and doubles up to interval while it holds still.
+void tracker_update(Tracker *t, const Config *cfg, double luma, double now);
+// The current interval within the configured limits (they may have changed)
+double tracker_interval(const Tracker *t, const Config *cfg);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Lumos: learned brightness curve
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "curve.h"
+#include "control.h"
+
+#define KNOT_STEP ((CURVE_LUT - 1) / (CURVE_KNOTS - 1)) // 17 luma between knots
+#define PRIOR_WEIGHT 0.05 // Pull of the built-in mapping on a trained knot
+#define WEIGHT_MAX 8.0    // Older corrections fade once a knot has this much behind it
+#define CURVE_MAGIC "lumos-curve"
+#define CURVE_VERSION 1
+
+void curve_reset(Curve *c) {
+    memset(c, 0, sizeof(*c));
+}
+
+void curve_train(Curve *c, double luma, double percent) {
+    if (luma < 0.0) luma = 0.0;
+    if (luma > CURVE_LUT - 1) luma = CURVE_LUT - 1;
+    if (percent < 0.0) percent = 0.0;
+    if (percent > 100.0) percent = 100.0;
+
+    int k = (int)(luma / KNOT_STEP);
+    if (k > CURVE_KNOTS - 2) k = CURVE_KNOTS - 2;
+    double t = luma / KNOT_STEP - k;
+
+    // Weighted running mean on each neighbour, in proportion to how close it is
+    double share[2] = { 1.0 - t, t };
+    for (int i = 0; i < 2; i++) {
+        if (share[i] <= 0.0) continue;
+        double *w = &c->weight[k + i];
+        *w += share[i];
+        c->value[k + i] += share[i] * (percent - c->value[k + i]) / *w;
+        if (*w > WEIGHT_MAX) *w = WEIGHT_MAX;
+    }
+    c->samples++;
+}
+
+void curve_compile(Curve *c, const Config *cfg) {
+    double v[CURVE_KNOTS], w[CURVE_KNOTS];
+    int n[CURVE_KNOTS];
+    int blocks = 0;
+
+    // Pool adjacent violators: merge neighbouring knots until the values never fall
+    for (int k = 0; k < CURVE_KNOTS; k++) {
+        double prior = control_base_percent(cfg, k * KNOT_STEP);
+        double weight = c->weight[k] + PRIOR_WEIGHT;
+        v[blocks] = (c->weight[k] * c->value[k] + PRIOR_WEIGHT * prior) / weight;
+        w[blocks] = weight;
+        n[blocks] = 1;
+        blocks++;
+        while (blocks > 1 && v[blocks - 2] > v[blocks - 1]) {
+            double merged = w[blocks - 2] + w[blocks - 1];
+            v[blocks - 2] = (w[blocks - 2] * v[blocks - 2] + w[blocks - 1] * v[blocks - 1]) / merged;
+            w[blocks - 2] = merged;
+            n[blocks - 2] += n[blocks - 1];
+            blocks--;
+        }
+    }
+
+    double knot[CURVE_KNOTS];
+    for (int b = 0, k = 0; b < blocks; b++) {
+        for (int i = 0; i < n[b]; i++) knot[k++] = v[b];
+    }
+
+    for (int i = 0; i < CURVE_LUT; i++) {
+        int k = i / KNOT_STEP;
+        if (k > CURVE_KNOTS - 2) k = CURVE_KNOTS - 2;
+        double t = (double)(i - k * KNOT_STEP) / KNOT_STEP;
+        c->lut[i] = (float)(knot[k] + (knot[k + 1] - knot[k]) * t);
+    }
+}
+
+void curve_format(const Curve *c, char *buf, size_t len) {
+    size_t off = snprintf(buf, len, "samples=%u", c->samples);
+    for (int k = 0; k < CURVE_KNOTS && off < len; k++) {
+        off += snprintf(buf + off, len - off, " %d=%.1f", k * KNOT_STEP, c->lut[k * KNOT_STEP]);
+    }
+}
+
+void curve_path_for(const char *config_path, char *buf, size_t len) {
+    config_sibling(config_path, "curve", buf, len);
+}
+
+int curve_load(Curve *c, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    Curve next;
+    curve_reset(&next);
+    int version, rc = -1;
+    if (fscanf(f, CURVE_MAGIC " %d %u", &version, &next.samples) == 2 && version == CURVE_VERSION) {
+        int k;
+        for (k = 0; k < CURVE_KNOTS; k++) {
+            int luma;
+            if (fscanf(f, "%d %lf %lf", &luma, &next.value[k], &next.weight[k]) != 3 || luma != k * KNOT_STEP ||
+                next.weight[k] < 0.0 || next.weight[k] > WEIGHT_MAX)
+                break;
+        }
+        if (k == CURVE_KNOTS) rc = 0;
+    }
+    fclose(f);
+
+    if (rc == 0) {
+        memcpy(c->value, next.value, sizeof(c->value));
+        memcpy(c->weight, next.weight, sizeof(c->weight));
+        c->samples = next.samples;
+    }
+    return rc;
+}
+
+int curve_save(const Curve *c, const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+
+    // Header, then "luma percent weight" per knot
+    fprintf(f, CURVE_MAGIC " %d %u\n", CURVE_VERSION, c->samples);
+    for (int k = 0; k < CURVE_KNOTS; k++) {
+        fprintf(f, "%d %.2f %.3f\n", k * KNOT_STEP, c->value[k], c->weight[k]);
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
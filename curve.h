@@ -0,0 +1,51 @@
+/*
+ * Lumos: learned brightness curve
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_CURVE_H
+#define LUMOS_CURVE_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+// Manual corrections are folded into knots spaced evenly over luma 0-255.
+// Untrained knots follow the built-in mapping; the compiled curve is made
+// monotonic (brighter room, never dimmer screen) and expanded into a table
+// so the sample path is a single lookup.
+#define CURVE_KNOTS 16
+#define CURVE_LUT 256
+
+typedef struct {
+    double value[CURVE_KNOTS];  // Learned percent at each knot
+    double weight[CURVE_KNOTS]; // Evidence behind it; 0 = untrained
+    unsigned samples;           // Training points folded in
+    float lut[CURVE_LUT];       // Compiled luma -> percent, before the min/max clamp
+} Curve;
+
+void curve_reset(Curve *c);
+// Folds in one (luma, percent) preference; touches only the two nearest knots
+void curve_train(Curve *c, double luma, double percent);
+// Rebuilds the table; needed after training or a change to the built-in mapping
+void curve_compile(Curve *c, const Config *cfg);
+
+static inline double curve_lookup(const Curve *c, double luma) {
+    int i = (int)(luma + 0.5);
+    if (i < 0) i = 0;
+    if (i >= CURVE_LUT) i = CURVE_LUT - 1;
+    return c->lut[i];
+}
+
+// Knots as luma=percent pairs for the CURVE command (no trailing newline)
+void curve_format(const Curve *c, char *buf, size_t len);
+
+// Training state lives next to the config file (lumos.conf -> lumos.curve)
+void curve_path_for(const char *config_path, char *buf, size_t len);
+// -1 if missing or malformed (c is left untouched)
+int curve_load(Curve *c, const char *path);
+// Written to a temp file and renamed into place
+int curve_save(const Curve *c, const char *path);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * Lumos: brightness-controlled displays
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <dirent.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "backlight.h"
+#include "stats.h"
+
+extern int verbose;
+
+static const DisplayOps *backends[] = { &sysfs_display, &ddc_display, &fake_display, NULL };
+
+static const DisplayOps *backend_for(const char *spec, const char **arg) {
+    for (int i = 0; backends[i]; i++) {
+        size_t n = strlen(backends[i]->prefix);
+        if (strncmp(spec, backends[i]->prefix, n) == 0) {
+            *arg = spec + n;
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+// "@LO-HI[^GAMMA]"
+static int parse_curve(const char *s, DisplayCurve *c) {
+    char *end;
+    c->lo = 0.0;
+    c->hi = 100.0;
+    c->gamma = 1.0;
+    if (*s == '\0') return 0;
+    if (*s++ != '@') return -1;
+
+    c->lo = strtod(s, &end);
+    if (end == s || *end != '-') return -1;
+    s = end + 1;
+    c->hi = strtod(s, &end);
+    if (end == s) return -1;
+    if (*end == '^') {
+        s = end + 1;
+        c->gamma = strtod(s, &end);
+        if (end == s) return -1;
+    }
+    if (*end != '\0') return -1;
+    if (c->lo < 0.0 || c->hi > 100.0 || c->lo > c->hi || c->gamma <= 0.0 || c->gamma > 10.0) return -1;
+    return 0;
+}
+
+// Splits "SPEC[@CURVE]" (len bytes of it) into its parts
+static int parse_entry(const char *entry, size_t len, char *spec, DisplayCurve *curve, const char **curve_text) {
+    char buf[DISPLAY_SPEC_LEN];
+    if (len == 0 || len >= sizeof(buf)) return -1;
+    memcpy(buf, entry, len);
+    buf[len] = '\0';
+
+    char *at = strchr(buf, '@');
+    if (parse_curve(at ? at : "", curve) < 0) return -1;
+    if (curve_text) *curve_text = at ? entry + (at - buf) : entry + len;
+    if (at) *at = '\0';
+    if (buf[0] == '\0') return -1;
+    strcpy(spec, buf);
+    return 0;
+}
+
+int display_list_check(const char *list) {
+    const char *p = list;
+    int entries = 0;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        char spec[DISPLAY_SPEC_LEN];
+        DisplayCurve curve;
+        const char *arg;
+        if (parse_entry(p, len, spec, &curve, NULL) < 0) return -1;
+        if (strcmp(spec, "backlight") != 0 && strcmp(spec, "ddc") != 0 && !backend_for(spec, &arg)) return -1;
+        entries++;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return entries > 0 ? 0 : -1;
+}
+
+static int add_spec(char specs[][DISPLAY_SPEC_LEN], int n, int max, const char *spec, const char *curve, int clen) {
+    if (n >= max) return n;
+    if (snprintf(specs[n], DISPLAY_SPEC_LEN, "%s%.*s", spec, clen, curve) >= DISPLAY_SPEC_LEN) return n;
+    return n + 1;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Firmware (ACPI) interfaces usually drive the same panel as a raw or
+// platform one next to them, so they are only used when nothing else is there
+static int is_firmware(const char *dir) {
+    char path[700], type[32] = "";
+    snprintf(path, sizeof(path), "%s/type", dir);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    if (!fgets(type, sizeof(type), f)) type[0] = '\0';
+    fclose(f);
+    return strncmp(type, "firmware", 8) == 0;
+}
+
+static int expand_backlight(const char *cls, char specs[][DISPLAY_SPEC_LEN], int n, int max,
+                            const char *curve, int clen) {
+    char path[600];
+
+    // -b may name a single device directory instead of the class
+    snprintf(path, sizeof(path), "%s/max_brightness", cls);
+    if (access(path, F_OK) == 0) {
+        snprintf(path, sizeof(path), "sysfs:%s", cls);
+        return add_spec(specs, n, max, path, curve, clen);
+    }
+
+    DIR *d = opendir(cls);
+    if (!d) return n;
+    char *names[DISPLAY_MAX * 4];
+    int count = 0, firmware = 0, other = 0;
+    int kind[DISPLAY_MAX * 4];
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL && count < (int)(sizeof(names) / sizeof(names[0]))) {
+        if (e->d_name[0] == '.') continue;
+        names[count++] = strdup(e->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(names[0]), by_name);
+
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", cls, names[i]);
+        kind[i] = is_firmware(path);
+        if (kind[i]) firmware++;
+        else other++;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!(firmware && other && kind[i])) {
+            snprintf(path, sizeof(path), "sysfs:%s/%s", cls, names[i]);
+            n = add_spec(specs, n, max, path, curve, clen);
+        }
+        free(names[i]);
+    }
+    return n;
+}
+
+static int is_i2c(const struct dirent *e) {
+    return strncmp(e->d_name, "i2c-", 4) == 0;
+}
+
+static int expand_ddc(char specs[][DISPLAY_SPEC_LEN], int n, int max, const char *curve, int clen) {
+    struct dirent **list;
+    int count = scandir("/dev", &list, is_i2c, alphasort);
+    if (count < 0) return n;
+    for (int i = 0; i < count; i++) {
+        char dev[300];
+        snprintf(dev, sizeof(dev), "/dev/%s", list[i]->d_name);
+        if (ddc_probe(dev)) {
+            char spec[310];
+            snprintf(spec, sizeof(spec), "ddc:%s", dev);
+            n = add_spec(specs, n, max, spec, curve, clen);
+        }
+        free(list[i]);
+    }
+    free(list);
+    return n;
+}
+
+int display_expand(const char *list, const char *backlight_class,
+                   char specs[][DISPLAY_SPEC_LEN], int max) {
+    int n = 0;
+    const char *p = list;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        char spec[DISPLAY_SPEC_LEN];
+        DisplayCurve curve;
+        const char *curve_text;
+        if (parse_entry(p, len, spec, &curve, &curve_text) == 0) {
+            int clen = (int)(p + len - curve_text);
+            if (strcmp(spec, "backlight") == 0) n = expand_backlight(backlight_class, specs, n, max, curve_text, clen);
+            else if (strcmp(spec, "ddc") == 0) n = expand_ddc(specs, n, max, curve_text, clen);
+            else n = add_spec(specs, n, max, spec, curve_text, clen);
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+    return n;
+}
+
+// Sends the newest pending level, then waits for another; exits once told to
+// stop and nothing is left, so the last level always reaches the device
+static void *writer_main(void *arg) {
+    Display *d = arg;
+    pthread_mutex_lock(&d->lock);
+    for (;;) {
+        while (d->pending < 0 && !d->stop) pthread_cond_wait(&d->wake, &d->lock);
+        if (d->pending < 0) break;
+        int level = d->pending;
+        d->pending = -1;
+        pthread_mutex_unlock(&d->lock);
+
+        uint64_t t0 = stats_now();
+        int rc = d->ops->write(d, level);
+        if (rc < 0) {
+            stats_count(COUNT_WRITE_FAILURES);
+            if (verbose) fprintf(stderr, "Failed to set %s to %d\n", d->name, level);
+            // Fall back to whatever the device says, unless a newer level is queued
+            int hw = d->ops->read(d);
+            pthread_mutex_lock(&d->lock);
+            if (hw >= 0 && d->pending < 0) atomic_store(&d->current, hw);
+            continue;
+        }
+        stats_record(STAGE_DISPLAY_WRITE, t0);
+        stats_count(COUNT_WRITES);
+        pthread_mutex_lock(&d->lock);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+static int writer_start(Display *d) {
+    d->pending = -1;
+    d->stop = 0;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->wake, NULL);
+
+    // Signals belong to the main loop's signalfd
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&d->writer, NULL, writer_main, d);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        pthread_cond_destroy(&d->wake);
+        pthread_mutex_destroy(&d->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void writer_stop(Display *d) {
+    pthread_mutex_lock(&d->lock);
+    d->stop = 1;
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->writer, NULL);
+    pthread_cond_destroy(&d->wake);
+    pthread_mutex_destroy(&d->lock);
+}
+
+int display_open(Display *d, const char *spec) {
+    memset(d, 0, sizeof(*d));
+
+    char base[DISPLAY_SPEC_LEN];
+    const char *arg;
+    const DisplayOps *ops;
+    if (parse_entry(spec, strlen(spec), base, &d->curve, NULL) < 0 || !(ops = backend_for(base, &arg))) {
+        if (verbose) fprintf(stderr, "Unknown display %s\n", spec);
+        return -1;
+    }
+
+    snprintf(d->spec, sizeof(d->spec), "%s", spec);
+    if (ops->open(d, arg) < 0) {
+        memset(d, 0, sizeof(*d));
+        return -1;
+    }
+    int level = ops->read(d);
+    atomic_store(&d->current, level);
+    d->ops = ops;
+    if (d->max <= 0 || level < 0 || (ops->async && writer_start(d) < 0)) {
+        ops->close(d);
+        memset(d, 0, sizeof(*d));
+        return -1;
+    }
+    return 0;
+}
+
+void display_close(Display *d) {
+    if (!d->ops) return;
+    if (d->ops->async) writer_stop(d);
+    d->ops->close(d);
+    memset(d, 0, sizeof(*d));
+}
+
+int display_read(Display *d) {
+    if (!d->ops) return -1;
+    if (d->ops->async) return display_current(d); // The writer owns the bus
+    int level = d->ops->read(d);
+    if (level >= 0) atomic_store(&d->current, level);
+    return level;
+}
+
+int display_write(Display *d, int level) {
+    if (!d->ops) return -1;
+    if (level < 0) level = 0;
+    if (level > d->max) level = d->max;
+    if (level == display_current(d)) {
+        stats_count(COUNT_WRITES_SKIPPED);
+        return 0;
+    }
+
+    if (!d->ops->async) {
+        if (d->ops->write(d, level) < 0) return -1;
+        atomic_store(&d->current, level);
+        return 1;
+    }
+
+    pthread_mutex_lock(&d->lock);
+    if (d->pending >= 0) stats_count(COUNT_WRITES_COALESCED);
+    d->pending = level;
+    atomic_store(&d->current, level);
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+    return 1;
+}
+
+int display_notify_fd(const Display *d) {
+    return d->ops && d->ops->notify_fd ? d->ops->notify_fd(d) : -1;
+}
+
+int display_powered(Display *d) {
+    return d->ops && d->ops->powered ? d->ops->powered(d) : -1;
+}
+
+// First word of a sysfs attribute
+static int read_word(const char *dir, const char *name, char word[32]) {
+    char path[700];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fscanf(f, "%31s", word) == 1;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+int drm_displays_on(const char *drm_class) {
+    DIR *dir = opendir(drm_class);
+    if (!dir) return -1;
+
+    int connected = 0, on = 0;
+    struct dirent *e;
+    while (!on && (e = readdir(dir)) != NULL) {
+        // Connectors are cardN-NAME; cardN itself and renderD* are not
+        if (strncmp(e->d_name, "card", 4) != 0 || !strchr(e->d_name, '-')) continue;
+        char conn[600], status[32], dpms[32];
+        snprintf(conn, sizeof(conn), "%s/%s", drm_class, e->d_name);
+        if (read_word(conn, "status", status) < 0 || strcmp(status, "connected") != 0) continue;
+        if (read_word(conn, "dpms", dpms) < 0) continue;
+        connected = 1;
+        if (strcmp(dpms, "On") == 0) on = 1;
+    }
+    closedir(dir);
+    return on ? 1 : connected ? 0 : -1;
+}
+
+int display_level(const Display *d, double percent) {
+    double p = percent / 100.0;
+    if (p < 0.0) p = 0.0;
+    if (p > 1.0) p = 1.0;
+    if (d->curve.gamma != 1.0) p = pow(p, d->curve.gamma);
+    double out = d->curve.lo + (d->curve.hi - d->curve.lo) * p;
+    return (int)(out / 100.0 * d->max + 1e-9);
+}
+
+// sysfs backlight: a thin wrapper over Backlight, fast enough to write inline
+
+static int sysfs_open(Display *d, const char *arg) {
+    Backlight *bl = malloc(sizeof(*bl));
+    if (!bl) return -1;
+    if (backlight_open(bl, arg) < 0) {
+        backlight_close(bl);
+        free(bl);
+        return -1;
+    }
+    const char *slash = strrchr(arg, '/');
+    snprintf(d->name, sizeof(d->name), "%s", slash && slash[1] ? slash + 1 : arg);
+    d->max = bl->max;
+    d->priv = bl;
+    return 0;
+}
+
+static void sysfs_close(Display *d) {
+    backlight_close(d->priv);
+    free(d->priv);
+}
+
+static int sysfs_read(Display *d) {
+    return backlight_read(d->priv);
+}
+
+static int sysfs_write(Display *d, int level) {
+    return backlight_write(d->priv, level) < 0 ? -1 : 0;
+}
+
+static int sysfs_notify_fd(const Display *d) {
+    return backlight_notify_fd(d->priv);
+}
+
+static int sysfs_powered(Display *d) {
+    return backlight_powered(d->priv);
+}
+
+const DisplayOps sysfs_display = {
+    .prefix = "sysfs:",
+    .async = 0,
+    .open = sysfs_open,
+    .close = sysfs_close,
+    .read = sysfs_read,
+    .write = sysfs_write,
+    .notify_fd = sysfs_notify_fd,
+    .powered = sysfs_powered,
+};
@@ -0,0 +1,99 @@
+/*
+ * Lumos: brightness-controlled displays
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_DISPLAY_H
+#define LUMOS_DISPLAY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define DISPLAY_MAX 8
+#define DISPLAY_SPEC_LEN 128
+
+// Where a display is driven. The `displays` setting is a comma-separated list of:
+//   backlight          every device in the backlight class (or the -b directory)
+//   ddc                every monitor answering DDC/CI on /dev/i2c-*
+//   sysfs:DIR          one backlight device directory
+//   ddc:/dev/i2c-N     one DDC/CI monitor (VCP 0x10)
+//   fake:NAME[/MS]     an in-memory device whose writes take MS milliseconds
+// each optionally followed by a curve, @LO-HI[^GAMMA]: the daemon's 0-100%
+// maps onto LO-HI% of the device's range, shaped by GAMMA (default 1).
+typedef struct Display Display;
+
+typedef struct {
+    const char *prefix;
+    int async; // Writes are slow; a writer thread sends them off the main loop
+    int (*open)(Display *d, const char *arg);
+    void (*close)(Display *d);
+    // Hardware level, -1 on failure
+    int (*read)(Display *d);
+    int (*write)(Display *d, int level);
+    // Raises POLLPRI when the level changes behind our back; NULL if it can't
+    int (*notify_fd)(const Display *d);
+    // 1 lit, 0 blanked, -1 can't tell; NULL if the backend has no notion of it
+    int (*powered)(Display *d);
+} DisplayOps;
+
+typedef struct {
+    double lo;
+    double hi;
+    double gamma;
+} DisplayCurve;
+
+struct Display {
+    const DisplayOps *ops; // NULL while closed
+    char spec[DISPLAY_SPEC_LEN];
+    char name[32];
+    int max;
+    atomic_int current;    // Hardware level; for async devices, where it is heading
+    DisplayCurve curve;
+    void *priv;
+
+    // Async devices: only the newest level waits to be sent
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int pending;           // -1 when nothing is waiting
+    int stop;
+};
+
+extern const DisplayOps sysfs_display;
+extern const DisplayOps ddc_display;
+extern const DisplayOps fake_display;
+
+// Checks the syntax of a `displays` list; -1 if malformed
+int display_list_check(const char *list);
+// Resolves backlight/ddc wildcards into one spec per device, curves carried
+// over; returns how many were written to specs
+int display_expand(const char *list, const char *backlight_class,
+                   char specs[][DISPLAY_SPEC_LEN], int max);
+// 1 if a DDC/CI monitor answers on the bus
+int ddc_probe(const char *dev);
+
+int display_open(Display *d, const char *spec);
+// Sends any pending level before returning
+void display_close(Display *d);
+
+// Reads the hardware level and refreshes the cache (async devices just report the cache)
+int display_read(Display *d);
+// Sets a level; a no-op if the device is already there. Async devices queue it
+// and return at once, replacing whatever was still waiting.
+int display_write(Display *d, int level);
+int display_notify_fd(const Display *d);
+// 1 lit, 0 blanked, -1 unknown
+int display_powered(Display *d);
+// DRM connectors under drm_class (/sys/class/drm): 1 if a connected one is
+// on (dpms On), 0 if all connected ones are off, -1 if none reports
+int drm_displays_on(const char *drm_class);
+
+static inline int display_current(Display *d) {
+    return atomic_load(&d->current);
+}
+
+// The device level for the daemon's brightness percentage, through its curve
+int display_level(const Display *d, double percent);
+
+#endif
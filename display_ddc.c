@@ -0,0 +1,139 @@
+/*
+ * Lumos: DDC/CI external monitors
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "display.h"
+
+extern int verbose;
+
+// ddc:/dev/i2c-N
+//
+// Brightness is VCP feature 0x10 over DDC/CI (MCCS). Monitors need ~40 ms to
+// answer a request and ~50 ms of quiet after a set, so every write costs tens
+// of milliseconds; the registry runs them on this display's writer thread.
+#define DDC_ADDR 0x37
+#define DDC_HOST 0x51
+#define DDC_DEST 0x6e
+#define DDC_REPLY_SRC 0x50
+#define VCP_BRIGHTNESS 0x10
+#define DDC_REPLY_DELAY_US 40000
+#define DDC_SET_DELAY_US 50000
+#define DDC_RETRIES 3
+
+typedef struct {
+    int fd;
+} Ddc;
+
+static int ddc_send(int fd, const unsigned char *payload, int len) {
+    unsigned char buf[16];
+    buf[0] = DDC_HOST;
+    buf[1] = 0x80 | len;
+    memcpy(buf + 2, payload, len);
+    unsigned char sum = DDC_DEST;
+    for (int i = 0; i < len + 2; i++) sum ^= buf[i];
+    buf[len + 2] = sum;
+    return write(fd, buf, len + 3) == len + 3 ? 0 : -1;
+}
+
+// Get VCP Feature; 0 and the current/maximum value on success
+static int ddc_get(int fd, int *cur, int *max) {
+    for (int attempt = 0; attempt < DDC_RETRIES; attempt++) {
+        unsigned char req[2] = { 0x01, VCP_BRIGHTNESS };
+        if (ddc_send(fd, req, sizeof(req)) < 0) return -1; // Nobody on the bus
+        usleep(DDC_REPLY_DELAY_US);
+
+        // Source, length, opcode 0x02, result, feature, type, max, value, checksum
+        unsigned char r[11];
+        if (read(fd, r, sizeof(r)) != sizeof(r)) continue;
+        unsigned char sum = DDC_REPLY_SRC;
+        for (int i = 0; i < 10; i++) sum ^= r[i];
+        if (r[0] != DDC_DEST || (r[1] & 0x7f) != 8 || r[2] != 0x02 || r[4] != VCP_BRIGHTNESS || sum != r[10])
+            continue;
+        if (r[3] != 0) return -1; // Monitor doesn't support the feature
+        *max = r[6] << 8 | r[7];
+        *cur = r[8] << 8 | r[9];
+        return 0;
+    }
+    return -1;
+}
+
+static int ddc_connect(const char *dev) {
+    int fd = open(dev, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (ioctl(fd, I2C_SLAVE, DDC_ADDR) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ddc_probe(const char *dev) {
+    int fd = ddc_connect(dev);
+    if (fd < 0) return 0;
+    int cur, max;
+    int ok = ddc_get(fd, &cur, &max) == 0 && max > 0;
+    close(fd);
+    return ok;
+}
+
+static int ddc_open(Display *d, const char *arg) {
+    Ddc *ddc = malloc(sizeof(*ddc));
+    if (!ddc) return -1;
+    int cur;
+    ddc->fd = ddc_connect(arg);
+    if (ddc->fd < 0 || ddc_get(ddc->fd, &cur, &d->max) < 0) {
+        if (verbose) fprintf(stderr, "No DDC/CI brightness control on %s\n", arg);
+        if (ddc->fd >= 0) close(ddc->fd);
+        free(ddc);
+        return -1;
+    }
+    const char *slash = strrchr(arg, '/');
+    snprintf(d->name, sizeof(d->name), "%s", slash ? slash + 1 : arg);
+    d->priv = ddc;
+    return 0;
+}
+
+static void ddc_close(Display *d) {
+    Ddc *ddc = d->priv;
+    close(ddc->fd);
+    free(ddc);
+}
+
+static int ddc_read(Display *d) {
+    Ddc *ddc = d->priv;
+    int cur, max;
+    if (ddc_get(ddc->fd, &cur, &max) < 0) return -1;
+    usleep(DDC_REPLY_DELAY_US); // Let the monitor rest before the next command
+    return cur;
+}
+
+static int ddc_write(Display *d, int level) {
+    Ddc *ddc = d->priv;
+    unsigned char req[4] = { 0x03, VCP_BRIGHTNESS, (level >> 8) & 0xff, level & 0xff };
+    int rc = -1;
+    for (int attempt = 0; attempt < DDC_RETRIES && rc < 0; attempt++) {
+        rc = ddc_send(ddc->fd, req, sizeof(req));
+        usleep(DDC_SET_DELAY_US); // Required quiet time, also between retries
+    }
+    return rc;
+}
+
+const DisplayOps ddc_display = {
+    .prefix = "ddc:",
+    .async = 1,
+    .open = ddc_open,
+    .close = ddc_close,
+    .read = ddc_read,
+    .write = ddc_write,
+    .notify_fd = NULL,
+};
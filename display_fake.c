@@ -0,0 +1,76 @@
+/*
+ * Lumos: in-memory stand-in display
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "display.h"
+
+// fake:NAME[/MS]
+//
+// Holds its level in memory on a 0-100 scale and takes MS milliseconds per
+// write, so a slow DDC/CI monitor can be exercised without one. Like DDC it
+// goes through a writer thread; DISPLAYS over the socket shows where it is.
+#define FAKE_MAX 100
+#define FAKE_START 50
+
+typedef struct {
+    int level;
+    int delay_ms;
+} Fake;
+
+static int fake_open(Display *d, const char *arg) {
+    char name[sizeof(d->name)];
+    int delay_ms = 0;
+    const char *slash = strchr(arg, '/');
+    size_t len = slash ? (size_t)(slash - arg) : strlen(arg);
+    if (len == 0 || len >= sizeof(name)) return -1;
+    if (slash) {
+        char *end;
+        long v = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || v < 0 || v > 10000) return -1;
+        delay_ms = (int)v;
+    }
+
+    Fake *f = malloc(sizeof(*f));
+    if (!f) return -1;
+    f->level = FAKE_START;
+    f->delay_ms = delay_ms;
+    memcpy(name, arg, len);
+    name[len] = '\0';
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->max = FAKE_MAX;
+    d->priv = f;
+    return 0;
+}
+
+static void fake_close(Display *d) {
+    free(d->priv);
+}
+
+static int fake_read(Display *d) {
+    Fake *f = d->priv;
+    return f->level;
+}
+
+static int fake_write(Display *d, int level) {
+    Fake *f = d->priv;
+    if (f->delay_ms > 0) usleep(f->delay_ms * 1000);
+    f->level = level;
+    return 0;
+}
+
+const DisplayOps fake_display = {
+    .prefix = "fake:",
+    .async = 1,
+    .open = fake_open,
+    .close = fake_close,
+    .read = fake_read,
+    .write = fake_write,
+    .notify_fd = NULL,
+};
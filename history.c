@@ -0,0 +1,30 @@
+/*
+ * Lumos: sample history
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stddef.h>
+
+#include "history.h"
+
+static HistoryEntry ring[HISTORY_LEN];
+static uint64_t last; // Entry seq lives in ring[(seq - 1) % HISTORY_LEN]
+
+void history_record(const HistoryEntry *e) {
+    ring[last % HISTORY_LEN] = *e;
+    last++;
+}
+
+uint64_t history_last(void) {
+    return last;
+}
+
+uint64_t history_first(void) {
+    return last > HISTORY_LEN ? last - HISTORY_LEN + 1 : 1;
+}
+
+const HistoryEntry *history_at(uint64_t seq) {
+    if (seq == 0 || seq > last || seq < history_first()) return NULL;
+    return &ring[(seq - 1) % HISTORY_LEN];
+}
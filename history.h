@@ -0,0 +1,33 @@
+/*
+ * Lumos: sample history
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_HISTORY_H
+#define LUMOS_HISTORY_H
+
+#include <stdint.h>
+
+// Fixed ring of the most recent samples; nothing is allocated after start.
+// Entries are numbered from 1 and keep their number for as long as they are
+// kept, so a client can ask for just what it hasn't seen.
+#define HISTORY_LEN 1024
+
+typedef struct {
+    int64_t time_ms;    // CLOCK_REALTIME
+    int16_t luma;       // Ambient reading, -1 if none (manual mode)
+    int8_t target;      // Percent the control loop asked for
+    int8_t brightness;  // Percent actually applied (after hysteresis)
+    uint8_t mode;       // 0=Auto, 1=Manual
+} HistoryEntry;
+
+void history_record(const HistoryEntry *e);
+// Number of the newest entry; 0 before the first
+uint64_t history_last(void);
+// Number of the oldest entry still kept
+uint64_t history_first(void);
+// NULL if seq was never recorded or has been overwritten
+const HistoryEntry *history_at(uint64_t seq);
+
+#endif
@@ -7,7 +7,9 @@ TUI_NAME="lumos-tui"
 INSTALL_PATH="/usr/local/bin/$BINARY_NAME"
 GUI_INSTALL_PATH="/usr/local/bin/$GUI_NAME"
 TUI_INSTALL_PATH="/usr/local/bin/$TUI_NAME"
+SLEEP_HOOK_PATH="/usr/lib/systemd/system-sleep/$BINARY_NAME"
 SERVICE_PATH="/etc/systemd/system/${BINARY_NAME}.service"
+SOCKET_UNIT_PATH="/etc/systemd/system/${BINARY_NAME}.socket"
 DESKTOP_ENTRY_PATH="/usr/share/applications/lumos-gui.desktop"
 
 GREEN='\033[0;32m'
@@ -107,6 +109,11 @@ fi
 sudo cp "$BINARY_NAME" "$INSTALL_PATH"
 sudo chmod +x "$INSTALL_PATH"
 
+# Pause sampling across suspend and re-sample on resume
+sudo mkdir -p "$(dirname "$SLEEP_HOOK_PATH")"
+sudo cp "lumos-sleep" "$SLEEP_HOOK_PATH"
+sudo chmod +x "$SLEEP_HOOK_PATH"
+
 # Install Config
 if [ ! -f "/etc/lumos.conf" ]; then
     echo "Installing default config to /etc/lumos.conf..."
@@ -166,11 +173,14 @@ sudo bash -c "cat > $SERVICE_PATH" <<EOF
 [Unit]
 Description=Lumos Intelligent Auto-Brightness
 After=systemd-user-sessions.service
+Requires=lumos.socket
 
 [Service]
-Type=simple
+# Reports READY=1 once the socket is up and the last brightness is restored
+Type=notify
 # Run the C binary (default interval: 60s)
 ExecStart=$INSTALL_PATH -i 60
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=on-failure
 RestartSec=5
 
@@ -179,16 +189,35 @@ User=root
 Group=root
 
 [Install]
+# Started at boot as well as by the socket: auto-brightness runs with no
+# client connected. READY=1 comes before the camera is opened.
 WantedBy=multi-user.target
 EOF
 
 echo "Service file created: $SERVICE_PATH"
 
+# Socket activation: /run/lumos.sock exists (and queues clients) before the daemon is up
+sudo bash -c "cat > $SOCKET_UNIT_PATH" <<EOF
+[Unit]
+Description=Lumos Control Socket
+
+[Socket]
+ListenStream=/run/lumos.sock
+SocketMode=0666
+
+[Install]
+WantedBy=sockets.target
+EOF
+
+echo "Socket unit created: $SOCKET_UNIT_PATH"
+
 # 5. ACTIVATION
 echo -e "${YELLOW}[5/5] Enabling service...${NC}"
 
 sudo systemctl daemon-reload
-sudo systemctl enable $BINARY_NAME
+# Both on purpose: the socket so clients never race the daemon, the service
+# because nothing else would start it until a client connected
+sudo systemctl enable $BINARY_NAME.socket $BINARY_NAME
 sudo systemctl restart $BINARY_NAME
 
 # FINAL STATUS
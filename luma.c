@@ -0,0 +1,218 @@
+/*
+ * Lumos: luma statistics kernels
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "luma.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LUMA_X86 1
+#endif
+
+/*
+ * All kernels share the same histogram strategy: four interleaved
+ * sub-histograms so consecutive equal pixels do not serialize on one
+ * counter, merged once at the end. The SIMD kernels vectorize the Y
+ * extraction, the sum and the min/max; the scatter stays scalar.
+ */
+
+static void finish(LumaStats *st, unsigned int hist4[4][256], uint64_t sum, unsigned int count,
+                   unsigned int lo, unsigned int hi) {
+    for (int v = 0; v < 256; v++) {
+        st->hist[v] = hist4[0][v] + hist4[1][v] + hist4[2][v] + hist4[3][v];
+    }
+    st->count = count;
+    st->mean = count ? (double)sum / count : 0.0;
+    st->min = count ? lo : 0;
+    st->max = count ? hi : 0;
+}
+
+void luma_stats_yuyv_scalar(const unsigned char *data, size_t bytes, LumaStats *st) {
+    unsigned int hist4[4][256];
+    memset(hist4, 0, sizeof(hist4));
+
+    uint64_t sum = 0;
+    unsigned int lo = 255, hi = 0;
+    size_t n = bytes / 2;
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned int y = data[i * 2];
+        hist4[i & 3][y]++;
+        sum += y;
+        if (y < lo) lo = y;
+        if (y > hi) hi = y;
+    }
+
+    finish(st, hist4, sum, (unsigned int)n, lo, hi);
+}
+
+#ifdef LUMA_X86
+
+__attribute__((target("sse2")))
+static void luma_stats_yuyv_sse2(const unsigned char *data, size_t bytes, LumaStats *st) {
+    unsigned int hist4[4][256];
+    memset(hist4, 0, sizeof(hist4));
+
+    const __m128i ymask = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vsum = zero;
+    __m128i vmin = _mm_set1_epi8((char)0xFF);
+    __m128i vmax = zero;
+    uint8_t lanes[16] __attribute__((aligned(16)));
+
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 16));
+        __m128i y = _mm_packus_epi16(_mm_and_si128(a, ymask), _mm_and_si128(b, ymask));
+
+        vsum = _mm_add_epi64(vsum, _mm_sad_epu8(y, zero));
+        vmin = _mm_min_epu8(vmin, y);
+        vmax = _mm_max_epu8(vmax, y);
+
+        _mm_store_si128((__m128i *)lanes, y);
+        for (int k = 0; k < 16; k += 4) {
+            hist4[0][lanes[k]]++;
+            hist4[1][lanes[k + 1]]++;
+            hist4[2][lanes[k + 2]]++;
+            hist4[3][lanes[k + 3]]++;
+        }
+    }
+
+    uint64_t sums[2] __attribute__((aligned(16)));
+    _mm_store_si128((__m128i *)sums, vsum);
+    uint64_t sum = sums[0] + sums[1];
+    unsigned int lo = 255, hi = 0;
+    unsigned int count = (unsigned int)(i / 2);
+    if (count) {
+        _mm_store_si128((__m128i *)lanes, vmin);
+        for (int k = 0; k < 16; k++) if (lanes[k] < lo) lo = lanes[k];
+        _mm_store_si128((__m128i *)lanes, vmax);
+        for (int k = 0; k < 16; k++) if (lanes[k] > hi) hi = lanes[k];
+    }
+
+    for (; i + 2 <= bytes; i += 2) {
+        unsigned int y = data[i];
+        hist4[0][y]++;
+        sum += y;
+        if (y < lo) lo = y;
+        if (y > hi) hi = y;
+        count++;
+    }
+
+    finish(st, hist4, sum, count, lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void luma_stats_yuyv_avx2(const unsigned char *data, size_t bytes, LumaStats *st) {
+    unsigned int hist4[4][256];
+    memset(hist4, 0, sizeof(hist4));
+
+    const __m256i ymask = _mm256_set1_epi16(0x00FF);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vsum = zero;
+    __m256i vmin = _mm256_set1_epi8((char)0xFF);
+    __m256i vmax = zero;
+    uint8_t lanes[32] __attribute__((aligned(32)));
+
+    size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+        // packus works per 128-bit lane; the pixel order does not matter here
+        __m256i y = _mm256_packus_epi16(_mm256_and_si256(a, ymask), _mm256_and_si256(b, ymask));
+
+        vsum = _mm256_add_epi64(vsum, _mm256_sad_epu8(y, zero));
+        vmin = _mm256_min_epu8(vmin, y);
+        vmax = _mm256_max_epu8(vmax, y);
+
+        _mm256_store_si256((__m256i *)lanes, y);
+        for (int k = 0; k < 32; k += 4) {
+            hist4[0][lanes[k]]++;
+            hist4[1][lanes[k + 1]]++;
+            hist4[2][lanes[k + 2]]++;
+            hist4[3][lanes[k + 3]]++;
+        }
+    }
+
+    uint64_t sums[4] __attribute__((aligned(32)));
+    _mm256_store_si256((__m256i *)sums, vsum);
+    uint64_t sum = sums[0] + sums[1] + sums[2] + sums[3];
+    unsigned int lo = 255, hi = 0;
+    unsigned int count = (unsigned int)(i / 2);
+    if (count) {
+        _mm256_store_si256((__m256i *)lanes, vmin);
+        for (int k = 0; k < 32; k++) if (lanes[k] < lo) lo = lanes[k];
+        _mm256_store_si256((__m256i *)lanes, vmax);
+        for (int k = 0; k < 32; k++) if (lanes[k] > hi) hi = lanes[k];
+    }
+
+    for (; i + 2 <= bytes; i += 2) {
+        unsigned int y = data[i];
+        hist4[0][y]++;
+        sum += y;
+        if (y < lo) lo = y;
+        if (y > hi) hi = y;
+        count++;
+    }
+
+    finish(st, hist4, sum, count, lo, hi);
+}
+
+#endif
+
+typedef void (*luma_kernel_fn)(const unsigned char *, size_t, LumaStats *);
+
+static luma_kernel_fn kernel;
+static const char *kernel_name = "scalar";
+
+static void resolve_kernel(void) {
+    kernel = luma_stats_yuyv_scalar;
+#ifdef LUMA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = luma_stats_yuyv_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = luma_stats_yuyv_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+void luma_stats_yuyv(const unsigned char *data, size_t bytes, LumaStats *st) {
+    if (!kernel) resolve_kernel();
+    kernel(data, bytes, st);
+}
+
+const char *luma_kernel_name(void) {
+    if (!kernel) resolve_kernel();
+    return kernel_name;
+}
+
+int luma_kernel_select(const char *name) {
+    if (!kernel) resolve_kernel();
+    if (strcmp(name, "scalar") == 0) {
+        kernel = luma_stats_yuyv_scalar;
+        kernel_name = "scalar";
+        return 0;
+    }
+#ifdef LUMA_X86
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        kernel = luma_stats_yuyv_sse2;
+        kernel_name = "sse2";
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        kernel = luma_stats_yuyv_avx2;
+        kernel_name = "avx2";
+        return 0;
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,39 @@
+/*
+ * Lumos: luma statistics kernels
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMA_H
+#define LUMA_H
+
+#include <stddef.h>
+
+typedef struct {
+    double mean;
+    unsigned int min;
+    unsigned int max;
+    unsigned int count;
+    unsigned int hist[256];
+} LumaStats;
+
+// Full-frame statistics over the Y plane of a packed YUYV buffer.
+// Dispatches to the fastest kernel the CPU supports.
+void luma_stats_yuyv(const unsigned char *data, size_t bytes, LumaStats *st);
+
+// Reference implementation, always available
+void luma_stats_yuyv_scalar(const unsigned char *data, size_t bytes, LumaStats *st);
+
+// Statistics over the 8x8 block means of an MJPEG frame's luma, read from
+// the DC coefficients alone (no IDCT, no libjpeg). count is the number of
+// blocks. -1 for a frame that is truncated, corrupt or not baseline Huffman.
+int luma_stats_mjpeg(const unsigned char *data, size_t bytes, LumaStats *st);
+
+// Name of the kernel luma_stats_yuyv() dispatches to ("avx2", "sse2", "scalar")
+const char *luma_kernel_name(void);
+
+// Makes luma_stats_yuyv() use the named kernel; -1 if it isn't built in or
+// the CPU lacks it. For tests and benchmarks.
+int luma_kernel_select(const char *name);
+
+#endif
@@ -7,7 +7,9 @@ from PyQt6.QtWidgets import (QApplication, QWidget, QVBoxLayout, QHBoxLayout,
                              QCheckBox, QSystemTrayIcon, QMenu, QComboBox)
 import glob
 import os
-from PyQt6.QtCore import Qt, QTimer
+import mmap
+import struct
+from PyQt6.QtCore import Qt, QTimer, QSocketNotifier
 from PyQt6.QtGui import QFont, QIcon, QAction
 
 try:
@@ -18,6 +20,95 @@ except ImportError:
     pass 
 
 SOCKET_PATH = "/run/lumos.sock"
+STATUS_PATH = "/run/lumos.status"
+
+
+class StatusPage:
+    """Seqlock reader for the daemon's status page (see status.h)."""
+
+    MAGIC = 0x534d554c
+    VERSION = 1
+    LAYOUT = struct.Struct("<IIIiQqiiiiiiiifiiiii64s32sQ")
+    FIELDS = ("magic", "version", "seq", "pid", "generation", "sample_time_ms",
+              "luma", "target", "brightness", "mode", "min_brightness", "max_brightness",
+              "interval", "brightness_offset", "sensitivity", "manual_brightness",
+              "stream_idle", "exposure_lock", "ramp_ms", "ramp_hz", "camera_dev", "camera_mode")
+
+    def __init__(self):
+        self.map = None
+
+    def read(self):
+        """Returns a dict of the current state, or None if the daemon isn't publishing."""
+        if self.map is None:
+            try:
+                with open(STATUS_PATH, "rb") as f:
+                    self.map = mmap.mmap(f.fileno(), self.LAYOUT.size, prot=mmap.PROT_READ)
+            except (OSError, ValueError):
+                return None
+
+        for _ in range(64):
+            seq = struct.unpack_from("<I", self.map, 8)[0]
+            if seq & 1:
+                continue
+            raw = self.map[:self.LAYOUT.size]
+            if struct.unpack_from("<I", self.map, 8)[0] != seq:
+                continue
+            s = dict(zip(self.FIELDS, self.LAYOUT.unpack(raw)))
+            if s["magic"] != self.MAGIC or s["version"] != self.VERSION or s["pid"] == 0:
+                return None
+            for k in ("camera_dev", "camera_mode"):
+                s[k] = s[k].split(b"\0", 1)[0].decode(errors="replace")
+            s["mode"] = "manual" if s["mode"] else "auto"
+            return s
+        return None
+
+
+class LumosConnection:
+    """Persistent newline-delimited connection to the daemon."""
+
+    def __init__(self):
+        self.sock = None
+        self.buf = b""
+
+    def connect(self):
+        if self.sock is None:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.settimeout(2.0)
+            sock.connect(SOCKET_PATH)
+            self.sock = sock
+            self.buf = b""
+        return self.sock
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+        self.sock = None
+        self.buf = b""
+
+    def send(self, cmd):
+        self.connect().sendall((cmd + "\n").encode())
+
+    def pop_line(self):
+        if b"\n" not in self.buf:
+            return None
+        line, self.buf = self.buf.split(b"\n", 1)
+        return line.decode(errors="replace")
+
+    def fill(self):
+        data = self.sock.recv(4096)
+        if not data:
+            self.close()
+            raise ConnectionError("daemon closed the connection")
+        self.buf += data
+
+    def request(self, cmd):
+        self.send(cmd)
+        while True:
+            line = self.pop_line()
+            if line is not None and not line.startswith("EVENT "):
+                return line
+            if line is None:
+                self.fill()
 
 class LumosGUI(QWidget):
     def __init__(self):
@@ -108,14 +199,39 @@ class LumosGUI(QWidget):
 
         layout.addLayout(btn_layout)
 
+        # Live readings pushed by the daemon
+        self.live_label = QLabel("Ambient: -   Target: -   Backlight: -")
+        self.live_label.setAlignment(Qt.AlignmentFlag.AlignCenter)
+        layout.addWidget(self.live_label)
+        self.live = {"luma": "-", "target": "-", "brightness": "-"}
+
         # Status Bar
         self.status_label = QLabel("Ready")
         self.status_label.setAlignment(Qt.AlignmentFlag.AlignCenter)
         self.status_label.setStyleSheet("color: gray;")
         layout.addWidget(self.status_label)
 
+        # One connection for commands, one for pushed events
+        self.conn = LumosConnection()
+        self.events = LumosConnection()
+        self.events_notifier = None
+        self.resubscribe_timer = QTimer(self)
+        self.resubscribe_timer.setInterval(2000)
+        self.resubscribe_timer.timeout.connect(self.subscribe)
+
+        # Live state comes from the status page when the daemon publishes one,
+        # otherwise from a subscription
+        self.status = StatusPage()
+        self.status_generation = None
+        self.status_timer = QTimer(self)
+        self.status_timer.setInterval(250)
+        self.status_timer.timeout.connect(self.poll_status)
+
         # Initial Load
         self.refresh_config()
+        if self.status.read() is None:
+            self.subscribe()
+        self.status_timer.start()
 
     def setup_tray(self):
         self.tray_icon = QSystemTrayIcon(self)
@@ -215,12 +331,48 @@ class LumosGUI(QWidget):
         slider.parent_layout = VBox 
         
         slider.valueChanged.connect(lambda v: self.update_label(slider, v))
-        slider.sliderReleased.connect(lambda: callback(slider.value()))
+
+        # Send while dragging, but no faster than the screen redraws; the
+        # release always flushes so the last value is never left behind
+        slider.callback = callback
+        slider.sent = default_val
+        slider.throttle = QTimer(self)
+        slider.throttle.setInterval(self.frame_interval())
+        slider.throttle.timeout.connect(lambda: self.flush_slider(slider))
+        slider.valueChanged.connect(lambda v: self.on_slider_moved(slider))
+        slider.sliderReleased.connect(lambda: self.flush_slider(slider))
         
         VBox.addWidget(slider)
         
         return slider
 
+    def frame_interval(self):
+        screen = QApplication.primaryScreen()
+        rate = screen.refreshRate() if screen else 0
+        return max(1, int(1000 / (rate if rate > 0 else 60)))
+
+    def on_slider_moved(self, slider):
+        # The first move goes out at once, later ones on the next tick
+        if not slider.throttle.isActive():
+            self.flush_slider(slider)
+            slider.throttle.start()
+
+    def flush_slider(self, slider):
+        val = slider.value()
+        if val == slider.sent:
+            slider.throttle.stop()
+            return
+        slider.sent = val
+        slider.callback(val)
+
+    def set_slider(self, slider, val):
+        # Reflect a value without sending it back
+        slider.blockSignals(True)
+        slider.setValue(val)
+        slider.blockSignals(False)
+        slider.sent = slider.value()
+        self.update_label(slider, slider.value())
+
     def update_label(self, slider, value):
         display_val = value / slider.float_scale
         slider.val_lbl.setText(f"{display_val:.1f}" if slider.float_scale > 1.0 else str(int(display_val)))
@@ -244,18 +396,81 @@ class LumosGUI(QWidget):
         self.send_cmd(f"SET interval {val}")
 
     def send_cmd(self, cmd):
+        # Retry once so a daemon restart only costs a reconnect
+        for attempt in range(2):
+            try:
+                return self.conn.request(cmd).strip()
+            except Exception as e:
+                self.conn.close()
+                if attempt == 1:
+                    self.status_label.setText(f"Error: {e}")
+                    self.status_label.setStyleSheet("color: red;")
+        return None
+
+    def subscribe(self):
         try:
-            client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-            client.settimeout(2.0)
-            client.connect(SOCKET_PATH)
-            client.sendall(cmd.encode())
-            response = client.recv(1024).decode().strip()
-            client.close()
-            return response
-        except Exception as e:
-            self.status_label.setText(f"Error: {e}")
-            self.status_label.setStyleSheet("color: red;")
-            return None
+            self.events.close()
+            self.events.send("SUBSCRIBE")
+            self.events.sock.setblocking(False)
+        except Exception:
+            self.events.close()
+            self.resubscribe_timer.start()
+            return
+        self.resubscribe_timer.stop()
+        self.events_notifier = QSocketNotifier(self.events.sock.fileno(), QSocketNotifier.Type.Read, self)
+        self.events_notifier.activated.connect(self.on_events_ready)
+
+    def on_events_ready(self):
+        try:
+            self.events.fill()
+        except BlockingIOError:
+            return
+        except Exception:
+            self.events_notifier.setEnabled(False)
+            self.events_notifier = None
+            self.events.close()
+            self.resubscribe_timer.start()
+            return
+
+        while True:
+            line = self.events.pop_line()
+            if line is None:
+                break
+            parts = line.split()
+            if len(parts) == 3 and parts[0] == "EVENT":
+                self.on_event(parts[1], parts[2])
+
+    def poll_status(self):
+        s = self.status.read()
+        if s is None:
+            if self.events.sock is None and not self.resubscribe_timer.isActive():
+                self.subscribe()
+            return
+        if s["generation"] == self.status_generation:
+            return
+        self.status_generation = s["generation"]
+        for key in ("luma", "target", "brightness", "mode"):
+            self.on_event(key, str(s[key]))
+
+    def on_event(self, key, val):
+        if key in self.live:
+            self.live[key] = val
+            self.live_label.setText(
+                f"Ambient: {self.live['luma']}   Target: {self.live['target']}%   "
+                f"Backlight: {self.live['brightness']}%")
+        elif key == "mode":
+            self.apply_mode(val == "auto")
+
+    def apply_mode(self, is_auto):
+        self.auto_checkbox.blockSignals(True)
+        self.auto_checkbox.setChecked(is_auto)
+        self.auto_checkbox.blockSignals(False)
+
+        self.auto_action.blockSignals(True)
+        self.auto_action.setChecked(is_auto)
+        self.auto_action.blockSignals(False)
+
+        self.manual_slider.setEnabled(not is_auto)
 
     def on_auto_toggled(self, checked):
         # Update both GUI box and Tray Action
@@ -280,20 +495,14 @@ class LumosGUI(QWidget):
         self.auto_action.setChecked(False) # Uncheck tray auto
         
         # Update slider if this came from tray
-        self.manual_slider.blockSignals(True)
-        self.manual_slider.setValue(val)
-        self.update_label(self.manual_slider, val)
-        self.manual_slider.blockSignals(False)
+        self.set_slider(self.manual_slider, val)
         
         self.manual_slider.setEnabled(True)
         self.send_cmd(f"SET brightness {val}")
 
     def on_sensitivity_change(self, val):
         # Update slider if called from tray
-        self.sensitivity_slider.blockSignals(True)
-        self.sensitivity_slider.setValue(val)
-        self.update_label(self.sensitivity_slider, val)
-        self.sensitivity_slider.blockSignals(False)
+        self.set_slider(self.sensitivity_slider, val)
         
         real_val = val / 10.0
         self.send_cmd(f"SET sensitivity {real_val:.2f}")
@@ -317,60 +526,45 @@ class LumosGUI(QWidget):
             self.status_label.setText(f"Save failed: {resp}")
 
     def refresh_config(self):
-        keys = ["mode", "manual_brightness", "min_brightness", "max_brightness", "brightness_offset", "sensitivity", "interval", "camera_dev"]
         try:
-            # Need to get mode first to set checkbox correctly
-            mode_resp = self.send_cmd("GET mode")
-            if mode_resp and not mode_resp.startswith("ERR"):
-                is_auto = (mode_resp == "auto")
-                
-                self.auto_checkbox.blockSignals(True)
-                self.auto_checkbox.setChecked(is_auto)
-                self.auto_checkbox.blockSignals(False)
-                
-                self.auto_action.blockSignals(True)
-                self.auto_action.setChecked(is_auto)
-                self.auto_action.blockSignals(False)
-                
-                self.manual_slider.setEnabled(not is_auto)
-
-            manual_resp = self.send_cmd("GET manual_brightness")
-            if manual_resp and not manual_resp.startswith("ERR"):
-                val = int(manual_resp)
-                self.manual_slider.blockSignals(True)
-                self.manual_slider.setValue(val)
-                self.update_label(self.manual_slider, val)
-                self.manual_slider.blockSignals(False)
+            values = self.status.read()
+            if values is None:
+                resp = self.send_cmd("GETALL")
+                if not resp or resp.startswith("ERR"):
+                    self.status_label.setText("Failed to load settings.")
+                    return
+                values = dict(item.split("=", 1) for item in resp.split() if "=" in item)
+
+            if "mode" in values:
+                self.apply_mode(values["mode"] == "auto")
+
+            if "manual_brightness" in values:
+                self.set_slider(self.manual_slider, int(values["manual_brightness"]))
 
             # Other config
-            # Other config
-            for k in ["min_brightness", "max_brightness", "brightness_offset", "sensitivity", "interval", "camera_dev"]:
-                resp = self.send_cmd(f"GET {k}")
-                if resp and not resp.startswith("ERR"):
-                    val = resp
-                    if k == "sensitivity":
-                        self.sensitivity_slider.setValue(int(float(val) * 10))
-                        self.update_label(self.sensitivity_slider, int(float(val) * 10))
-                    elif k == "brightness_offset":
-                        self.offset_slider.setValue(int(val))
-                        self.update_label(self.offset_slider, int(val))
-                    elif k == "min_brightness":
-                        self.min_slider.setValue(int(val))
-                        self.update_label(self.min_slider, int(val))
-                    elif k == "max_brightness":
-                        self.max_slider.setValue(int(val))
-                        self.update_label(self.max_slider, int(val))
-                    elif k == "interval":
-                        self.interval_slider.setValue(int(val))
-                        self.update_label(self.interval_slider, int(val))
-                    elif k == "camera_dev":
-                        idx = self.webcam_combo.findText(val.strip())
-                        if idx >= 0:
-                            self.webcam_combo.setCurrentIndex(idx)
-                        else:
-                            # If not found (maybe not plugged in now but in config), add it temporarily?
-                            self.webcam_combo.addItem(val.strip())
-                            self.webcam_combo.setCurrentText(val.strip())
+            for k, val in values.items():
+                if k == "sensitivity":
+                    self.set_slider(self.sensitivity_slider, round(float(val) * 10))
+                elif k == "brightness_offset":
+                    self.set_slider(self.offset_slider, int(val))
+                elif k == "min_brightness":
+                    self.set_slider(self.min_slider, int(val))
+                elif k == "max_brightness":
+                    self.set_slider(self.max_slider, int(val))
+                elif k == "interval":
+                    self.set_slider(self.interval_slider, int(val))
+                elif k == "camera_dev":
+                    idx = self.webcam_combo.findText(val.strip())
+                    self.webcam_combo.blockSignals(True)
+                    if idx >= 0:
+                        self.webcam_combo.setCurrentIndex(idx)
+                    else:
+                        # If not found (maybe not plugged in now but in config), add it temporarily?
+                        self.webcam_combo.addItem(val.strip())
+                        self.webcam_combo.setCurrentText(val.strip())
+                    self.webcam_combo.blockSignals(False)
+                elif k in self.live:
+                    self.on_event(k, val)
             
             self.status_label.setText("Settings loaded.")
             self.status_label.setStyleSheet("color: blue;")
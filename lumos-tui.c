@@ -2,11 +2,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include "status.h"
+
 #define SOCKET_PATH "/run/lumos.sock"
+#define GRAPH_MAX 256 // Samples kept for the graph
+#define SEND_PERIOD_MS 16 // A held arrow key sends at most one SET per frame
 
 typedef struct {
     char key[32];
@@ -16,6 +23,7 @@ typedef struct {
     double max;
     double step;
     int type; // 0=float, 1=int, 2=mode(0=auto/1=manual), 3=webcam(index)
+    int pending; // Edited but not sent yet; the daemon's value is stale until it is
 } Parameter;
 
 Parameter params[] = {
@@ -30,55 +38,242 @@ Parameter params[] = {
 };
 int param_count = 8;
 
-// IPC Helper
-void send_cmd(const char *cmd, char *resp, size_t resp_len) {
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd == -1) {
-        snprintf(resp, resp_len, "ERR Socket");
-        return;
-    }
+// Live readings pushed by the daemon
+int live_luma = -1;
+int live_target = -1;
+int live_brightness = -1;
+uint64_t live_history_seq = 0;
+
+// Recent samples, oldest first; only entries past history_seen are fetched
+int graph_luma[GRAPH_MAX];
+int graph_brightness[GRAPH_MAX];
+int graph_len = 0;
+uint64_t history_seen = 0;
+
+// Read straight from the daemon's status page when it is there;
+// the socket is then only used for writes
+const LumosStatus *status_page = NULL;
+
+// One persistent connection: replies and pushed EVENT lines share it
+int sock_fd = -1;
+char rbuf[16384];
+size_t rlen = 0;
+
+void disconnect() {
+    if (sock_fd >= 0) close(sock_fd);
+    sock_fd = -1;
+    rlen = 0;
+}
+
+int lumos_connect() {
+    if (sock_fd >= 0) return 0;
+
+    sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_fd == -1) return -1;
     
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path)-1);
     
-    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-        snprintf(resp, resp_len, "ERR Connect");
-        close(fd);
-        return;
+    if (connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        disconnect();
+        return -1;
     }
-    
-    write(fd, cmd, strlen(cmd));
-    int n = read(fd, resp, resp_len-1);
-    if (n >= 0) resp[n] = '\0';
-    else resp[0] = '\0';
-    
-    close(fd);
+    return 0;
 }
 
-void load_values() {
-    char resp[64];
+// Pops one buffered line; 0 if none is complete yet
+int pop_line(char *line, size_t len) {
+    char *nl = memchr(rbuf, '\n', rlen);
+    if (!nl) return 0;
+    size_t n = nl - rbuf;
+    snprintf(line, len, "%.*s", (int)n, rbuf);
+    rlen -= n + 1;
+    memmove(rbuf, nl + 1, rlen);
+    return 1;
+}
+
+int fill_buffer() {
+    if (rlen == sizeof(rbuf)) rlen = 0; // Garbage without newlines; drop it
+    ssize_t n = read(sock_fd, rbuf + rlen, sizeof(rbuf) - rlen);
+    if (n <= 0) {
+        disconnect();
+        return -1;
+    }
+    rlen += n;
+    return 0;
+}
+
+int find_param(const char *key) {
     for (int i=0; i<param_count; i++) {
-        char cmd[64];
-        snprintf(cmd, sizeof(cmd), "GET %s", params[i].key);
-        send_cmd(cmd, resp, sizeof(resp));
-        
-        if (strncmp(resp, "ERR", 3) != 0) {
-            if (params[i].type == 2) { // Mode
-                if (strstr(resp, "manual")) params[i].value = 1;
-                else params[i].value = 0;
-            } else if (params[i].type == 3) { // Webcam
-                int devId = 0;
-                sscanf(resp, "/dev/video%d", &devId);
-                params[i].value = devId;
-            } else {
-                params[i].value = atof(resp);
+        if (strcmp(params[i].key, key) == 0) return i;
+    }
+    return -1;
+}
+
+void apply_value(const char *key, const char *val) {
+    if (strcmp(key, "luma") == 0) live_luma = atoi(val);
+    else if (strcmp(key, "target") == 0) live_target = atoi(val);
+    else if (strcmp(key, "brightness") == 0) live_brightness = atoi(val);
+
+    int i = find_param(key);
+    if (i < 0 || params[i].pending) return;
+    if (params[i].type == 2) { // Mode
+        params[i].value = strstr(val, "manual") ? 1 : 0;
+    } else if (params[i].type == 3) { // Webcam
+        int devId = 0;
+        sscanf(val, "/dev/video%d", &devId);
+        params[i].value = devId;
+    } else {
+        params[i].value = atof(val);
+    }
+}
+
+void set_number(const char *key, double v) {
+    int i = find_param(key);
+    if (i >= 0 && !params[i].pending) params[i].value = v;
+}
+
+// Takes a snapshot of the status page; -1 if the daemon isn't publishing one
+int read_status() {
+    LumosStatus s;
+    if (!status_page) status_page = status_map(STATUS_PATH);
+    if (!status_page || status_read(status_page, &s) < 0) return -1;
+
+    set_number("mode", s.mode);
+    set_number("manual_brightness", s.manual_brightness);
+    set_number("sensitivity", s.sensitivity);
+    set_number("brightness_offset", s.brightness_offset);
+    set_number("min_brightness", s.min_brightness);
+    set_number("max_brightness", s.max_brightness);
+    set_number("interval", s.interval);
+    apply_value("camera_dev", s.camera_dev);
+    live_luma = s.luma;
+    live_target = s.target;
+    live_brightness = s.brightness;
+    live_history_seq = s.history_seq;
+    return 0;
+}
+
+void handle_event(const char *line) {
+    char key[64], val[128];
+    if (sscanf(line, "EVENT %63s %127s", key, val) == 2) apply_value(key, val);
+}
+
+// Applies any pushed events already waiting on the socket
+void drain_events() {
+    char line[512];
+    struct pollfd pfd = { .fd = sock_fd, .events = POLLIN };
+    while (sock_fd >= 0 && poll(&pfd, 1, 0) > 0) {
+        if (fill_buffer() < 0) return;
+        while (pop_line(line, sizeof(line))) handle_event(line);
+    }
+}
+
+// IPC Helper
+void send_cmd(const char *cmd, char *resp, size_t resp_len) {
+    if (lumos_connect() < 0) {
+        snprintf(resp, resp_len, "ERR Connect");
+        return;
+    }
+
+    char line[512];
+    snprintf(line, sizeof(line), "%s\n", cmd);
+    if (write(sock_fd, line, strlen(line)) < 0) {
+        disconnect();
+        snprintf(resp, resp_len, "ERR Socket");
+        return;
+    }
+
+    // Events may arrive ahead of our reply
+    while (1) {
+        while (pop_line(resp, resp_len)) {
+            if (strncmp(resp, "EVENT ", 6) == 0) {
+                handle_event(resp);
+                continue;
             }
+            return;
+        }
+        if (fill_buffer() < 0) {
+            snprintf(resp, resp_len, "ERR Socket");
+            return;
         }
     }
 }
 
+void graph_push(int luma, int brightness) {
+    if (graph_len == GRAPH_MAX) {
+        memmove(graph_luma, graph_luma + 1, sizeof(int) * (GRAPH_MAX - 1));
+        memmove(graph_brightness, graph_brightness + 1, sizeof(int) * (GRAPH_MAX - 1));
+        graph_len--;
+    }
+    graph_luma[graph_len] = luma;
+    graph_brightness[graph_len] = brightness;
+    graph_len++;
+}
+
+// Appends the samples recorded since the last fetch
+void fetch_history() {
+    char cmd[64], resp[GRAPH_MAX * 24 + 64];
+    snprintf(cmd, sizeof(cmd), "HISTORY %d %llu", GRAPH_MAX, (unsigned long long)history_seen);
+    send_cmd(cmd, resp, sizeof(resp));
+    if (strncmp(resp, "ERR", 3) == 0) return;
+
+    char *p = resp;
+    uint64_t newest = strtoull(p, &p, 10);
+    if (newest < history_seen) {
+        // The daemon restarted; start the graph over
+        graph_len = 0;
+        history_seen = 0;
+        return;
+    }
+    strtoll(p, &p, 10); // Time of the first entry; the graph doesn't use it
+    long long dt;
+    int luma, target, brightness;
+    char mode;
+    int used;
+    while (sscanf(p, " +%lld,%d,%d,%d,%c%n", &dt, &luma, &target, &brightness, &mode, &used) == 5) {
+        graph_push(luma, brightness);
+        p += used;
+    }
+    history_seen = newest;
+}
+
+// One character per sample, denser for higher values; blank where there is none
+void draw_sparkline(int y, int x, const char *label, const int *v, int n, int max, int width) {
+    static const char ramp[] = " .:-=+*#%@";
+    int levels = sizeof(ramp) - 2;
+    if (n > width) {
+        v += n - width;
+        n = width;
+    }
+    mvprintw(y, x, "%-10s", label);
+    for (int i = 0; i < n; i++) {
+        int l = v[i] < 0 ? -1 : v[i] * levels / max;
+        if (l > levels) l = levels;
+        mvaddch(y, x + 10 + i, l < 0 ? ' ' : ramp[l + 1]);
+    }
+}
+
+void load_values() {
+    if (read_status() == 0) return;
+
+    char resp[2048];
+    send_cmd("GETALL", resp, sizeof(resp));
+    if (strncmp(resp, "ERR", 3) == 0) return;
+
+    char *save;
+    for (char *tok = strtok_r(resp, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        apply_value(tok, eq + 1);
+    }
+
+    send_cmd("SUBSCRIBE", resp, sizeof(resp));
+}
+
 void save_value(int idx) {
     char cmd[64];
     if (params[idx].type == 2) {
@@ -102,8 +297,40 @@ void save_value(int idx) {
     send_cmd(cmd, resp, sizeof(resp));
 }
 
+// Key repeat outruns the screen, so adjustments are sent at most once per
+// SEND_PERIOD_MS; the last one is always sent, once its turn comes
+int unsent = -1; // Param changed since its last SET, or -1
+long long last_sent_ms = 0;
+
+long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Milliseconds until the pending change may go out, -1 if nothing is pending
+int flush_value(int force) {
+    if (unsent < 0) return -1;
+    long long wait = last_sent_ms + SEND_PERIOD_MS - now_ms();
+    if (wait > 0 && !force) return (int)wait;
+    save_value(unsent);
+    // Only one param is ever unsent; the mode shown with it was implied by it
+    for (int i = 0; i < param_count; i++) params[i].pending = 0;
+    unsent = -1;
+    last_sent_ms = now_ms();
+    return -1;
+}
+
+void queue_value(int idx) {
+    if (unsent >= 0 && unsent != idx) flush_value(1);
+    unsent = idx;
+    params[idx].pending = 1;
+    flush_value(0);
+}
+
 void persist() {
     char resp[64];
+    flush_value(1);
     send_cmd("PERSIST", resp, sizeof(resp));
 }
 
@@ -128,7 +355,12 @@ int main() {
     int ch;
 
     while(1) {
-        clear();
+        drain_events();
+        int use_page = read_status() == 0;
+        // The page says when there is something new; without it, ask on every wakeup
+        if (use_page ? live_history_seq != history_seen : sock_fd >= 0) fetch_history();
+
+        erase(); // Unlike clear(), lets refresh() send only what changed
         attron(COLOR_PAIR(1) | A_BOLD);
         mvprintw(1, 2, "Lumos TUI Control");
         attroff(COLOR_PAIR(1) | A_BOLD);
@@ -158,8 +390,41 @@ int main() {
             if (i == selection) attroff(COLOR_PAIR(2));
         }
 
+        attron(COLOR_PAIR(4));
+        if (use_page || sock_fd >= 0) {
+            mvprintw(7+param_count, 4, "Ambient %3d   Target %3d%%   Backlight %3d%%",
+                     live_luma, live_target, live_brightness);
+        } else {
+            mvprintw(7+param_count, 4, "Daemon not reachable (%s)", SOCKET_PATH);
+        }
+        attroff(COLOR_PAIR(4));
+
+        int graph_width = COLS - 16;
+        if (graph_width > GRAPH_MAX) graph_width = GRAPH_MAX;
+        if (graph_len > 0 && graph_width > 0) {
+            attron(COLOR_PAIR(1));
+            draw_sparkline(11+param_count, 4, "Ambient", graph_luma, graph_len, 255, graph_width);
+            draw_sparkline(12+param_count, 4, "Backlight", graph_brightness, graph_len, 100, graph_width);
+            attroff(COLOR_PAIR(1));
+        }
+
         refresh();
 
+        // Sleep until a key arrives or the daemon pushes an update;
+        // the status page has no wakeup, so re-read it a few times a second
+        struct pollfd pfds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = sock_fd, .events = POLLIN }
+        };
+        int timeout = use_page ? 250 : (sock_fd >= 0 ? -1 : 2000);
+        int wait = flush_value(0);
+        if (wait >= 0 && (timeout < 0 || wait < timeout)) timeout = wait;
+        poll(pfds, sock_fd >= 0 ? 2 : 1, timeout);
+        if (!(pfds[0].revents & POLLIN)) {
+            if (!use_page && sock_fd < 0) load_values(); // Try to reconnect
+            continue;
+        }
+
         ch = getch();
         if (ch == 'q' || ch == 'Q') break;
         else if (ch == KEY_UP) {
@@ -174,33 +439,36 @@ int main() {
             params[selection].value -= params[selection].step;
             if (params[selection].value < params[selection].min) 
                 params[selection].value = params[selection].min;
-            save_value(selection); // Instant update
+            queue_value(selection);
             
             // If we changed manual brightness, mode might have switched to manual
             if (strcmp(params[selection].key, "manual_brightness") == 0) {
                  params[0].value = 1; // Hack: Force UI to show Manual
+                 params[0].pending = params[selection].pending;
             }
         }
         else if (ch == KEY_RIGHT) {
             params[selection].value += params[selection].step;
             if (params[selection].value > params[selection].max) 
                 params[selection].value = params[selection].max;
-            save_value(selection); // Instant update
+            queue_value(selection);
             
             if (strcmp(params[selection].key, "manual_brightness") == 0) {
                  params[0].value = 1; // Hack: Force UI to show Manual
+                 params[0].pending = params[selection].pending;
             }
         }
         else if (ch == 's' || ch == 'S' || ch == 10) { // Enter or S
             persist();
             attron(COLOR_PAIR(3));
-            mvprintw(16, 2, "Configuration Saved!");
+            mvprintw(9+param_count, 2, "Configuration Saved!");
             attroff(COLOR_PAIR(3));
             refresh();
             napms(1000);
         }
     }
 
+    flush_value(1);
     endwin();
     return 0;
 }
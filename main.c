@@ -4,6 +4,7 @@
  * License: MIT
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,337 +17,1571 @@
 #include <dirent.h>
 #include <getopt.h>
 #include <stdarg.h> 
+#include <signal.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
-#define SOCKET_PATH "/run/lumos.sock"
+#include "source.h"
+#include "als.h"
+#include "luma.h"
+#include "display.h"
+#include "ramp.h"
+#include "status.h"
+#include "config.h"
+#include "stats.h"
+#include "control.h"
+#include "curve.h"
+#include "systemd.h"
+#include "history.h"
 
+#define SOCKET_PATH "/run/lumos.sock"
+#define BACKLIGHT_CLASS "/sys/class/backlight"
+#define DRM_CLASS "/sys/class/drm"
 
-#define DEFAULT_INTERVAL 60
-#define DEFAULT_CAMERA_DEV "/dev/video0"
-#define MIN_BRIGHTNESS_PERCENT 5
-#define MAX_BRIGHTNESS_PERCENT 100
-#define WARMUP_FRAMES 5
-#define WIDTH 640
-#define HEIGHT 480
 
-char backlight_path[512] = {0};
+#define WARMUP_MAX_FRAMES 15    // Hard cap on frames spent waiting for auto-exposure
+#define CONVERGE_DELTA 1.5      // Mean luma change between frames that still counts as settled
+#define CONVERGE_FRAMES 2       // Settled frames in a row before we trust the reading
+#define EXPOSURE_STEPS 4        // Exposure corrections per sample when locked
+#define LUMA_CLIPPED_HIGH 235
+#define LUMA_CLIPPED_LOW 16
+#define FIRST_FRAME_TIMEOUT 4.0 // Seconds a freshly opened camera gets to deliver
+#define FRAME_TIMEOUT 1.0       // ...and between frames after that
+#define RETRY_MIN 2.0           // Seconds before retrying a failed camera, doubling each time
+#define RETRY_MAX 300.0
+#define BUSY_DEFER 60.0         // Seconds to leave a camera another application is using
+#define MAX_CLIENTS 64
+#define CLIENT_BUF 512
+#define CLIENT_OUT_MAX 65536    // A subscriber this far behind gets dropped
+#define LEGACY_QUIET 0.2        // Seconds an unterminated first command waits for the rest of its line
+#define STATS_EXPORT_PERIOD 15  // Seconds between textfile exports
+#define PERSIST_DELAY 1.0       // Seconds a PERSIST waits so a burst of them is written once
+#define SET_COALESCE 0.05       // Seconds of SETs merged into one re-evaluation after the first
+#define RELOAD_DELAY 0.2        // Seconds to let an editor finish with the config file
+#define STATE_SAVE_PERIOD 60    // Seconds between state file refreshes
+#define POWER_POLL 2.0          // Seconds between display power checks after a change...
+#define POWER_POLL_MAX 32.0     // ...doubling up to this while nothing changes
+#define SLEEP_GAP 5.0           // Seconds of suspend that count as a resume worth re-sampling for
+#define STATE_MAGIC "lumos-state"
+#define STATE_VERSION 1
 
+char *backlight_class = BACKLIGHT_CLASS;
+char *drm_class = DRM_CLASS;
+// Runtime files; -r moves both (e.g. for unprivileged test runs)
+char socket_path[256] = SOCKET_PATH;
+char status_path[256] = STATUS_PATH;
+// Live state reported over IPC
+int last_luma = -1;
+int panel_off = 0;          // Every display is dark: auto mode stops sampling
+double last_lux = -1.0;     // From the ALS, when it took the last reading
+const char *last_sensor = "none";
+// Filtered ambient light and the adaptive sampling interval
+Tracker tracker;
+// Luma-to-brightness mapping, trained by manual changes made soon after an auto reading
+Curve curve;
+Curve curve_before;         // The curve before the current reading's correction
+char curve_path[512];
+unsigned auto_readings = 0; // Auto-mode samples taken so far
+unsigned learned_reading = 0; // ...and the one the last correction was about
+uint64_t last_auto_ns = 0;
+double last_auto_luma = 0.0;
+int last_target = -1;      // Level the control loop asked of the first display
+double last_percent = -1.0; // ...and the percentage every display was sent
+char state_path[512];       // last_percent across restarts (lumos.state)
+int state_dirty = 0;
+uint64_t last_state_save = 0;
+int published_brightness = -1;
+int published_mode = -1;
+int64_t last_sample_ms = 0; // Wall-clock time of the last successful sample
+LumosStatus *status_page = NULL;
 
-typedef struct {
-    int min_brightness;
-    int max_brightness;
-    int interval;
-    int brightness_offset;
-    float sensitivity;
-    int mode; // 0=Auto, 1=Manual
-    int manual_brightness;
-    char camera_dev[64];
-} Config;
-
-Config config = {
-    .min_brightness = MIN_BRIGHTNESS_PERCENT,
-    .max_brightness = MAX_BRIGHTNESS_PERCENT,
-    .interval = DEFAULT_INTERVAL,
-    .brightness_offset = 0,
-    .sensitivity = 1.0f,
-    .mode = 0,
-    .manual_brightness = 50,
-    .camera_dev = DEFAULT_CAMERA_DEV
-};
 
 // Global config path for persistence
 char *g_config_path = "/etc/lumos.conf";
 int verbose = 0;
 
-// Synchronization for instant updates
-pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+void log_msg(const char *format, ...) {
+    if (!verbose) return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+// Everything the loop waits on is a Watch; epoll hands it back in data.ptr
+typedef struct Watch {
+    int fd;
+    void (*on_event)(struct Watch *w, uint32_t events);
+} Watch;
+
+int epfd = -1;
+int running = 1;
+
+int watch_add(Watch *w, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = w };
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, w->fd, &ev);
+}
+
+void watch_mod(Watch *w, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = w };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, w->fd, &ev);
+}
+
+void watch_del(Watch *w) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL);
+}
+
+// One-shot CLOCK_MONOTONIC timer; 0 fires as soon as the loop comes round
+void timer_arm(int fd, double seconds) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (seconds <= 0.0) seconds = 1e-9;
+    its.it_value.tv_sec = (time_t)seconds;
+    its.it_value.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+void timer_disarm(int fd) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+int timer_drain(int fd) {
+    uint64_t expirations;
+    return read(fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+// A display plus what the loop needs to drive it
+typedef struct {
+    Display dev;
+    Ramp ramp;
+    Watch ramp_w;
+    Watch notify_w;
+} Output;
 
+Output outputs[DISPLAY_MAX];
+int output_count = 0;
+// Reports and the control loop's hysteresis follow the first display
+Display *primary = &outputs[0].dev;
 
+void on_sample_timer(Watch *w, uint32_t events);
+Watch sample_timer = { .fd = -1, .on_event = on_sample_timer };
+void schedule_sample(double seconds) {
+    timer_arm(sample_timer.fd, seconds);
+}
+
+void apply_changes(unsigned changed);
+int calibrate_request();
+double sample_interval();
+
+// Re-reads the file over the current settings and swaps the result in whole
 void load_config(const char *config_path) {
-    FILE *f = fopen(config_path, "r");
-    if (!f) {
+    Config next = *config_get();
+    if (config_load(config_path, &next) < 0) {
         if (verbose) printf("Config file not found: %s (using defaults)\n", config_path);
         return;
     }
 
-    char line[256];
-    while (fgets(line, sizeof(line), f)) {
-        if (line[0] == '#' || line[0] == '\n') continue;
-
-        char key[128], val_str[128];
-        if (sscanf(line, "%127[^=]=%127s", key, val_str) == 2) {
-            if (strcmp(key, "min_brightness") == 0) {
-                int val = atoi(val_str);
-                if (val >= 0 && val <= 100) config.min_brightness = val;
-            } else if (strcmp(key, "max_brightness") == 0) {
-                int val = atoi(val_str);
-                if (val >= 0 && val <= 100) config.max_brightness = val;
-            } else if (strcmp(key, "interval") == 0) {
-                int val = atoi(val_str);
-                if (val > 0) config.interval = val;
-            } else if (strcmp(key, "brightness_offset") == 0) {
-                config.brightness_offset = atoi(val_str);
-            } else if (strcmp(key, "sensitivity") == 0) {
-                float val = atof(val_str);
-                if (val > 0.0) config.sensitivity = val;
-            } else if (strcmp(key, "mode") == 0) {
-                if (strcmp(val_str, "manual") == 0 || strcmp(val_str, "1") == 0) config.mode = 1;
-                else config.mode = 0;
-            } else if (strcmp(key, "manual_brightness") == 0) {
-                config.manual_brightness = atoi(val_str);
-            } else if (strcmp(key, "camera_dev") == 0) {
-                strncpy(config.camera_dev, val_str, sizeof(config.camera_dev) - 1);
-            }
-        }
-    }
-    fclose(f);
-    
-    if (config.min_brightness >= config.max_brightness) {
-        config.min_brightness = 5;
-        config.max_brightness = 100;
+    if (config_check(&next) < 0) {
+        Config def;
+        config_defaults(&def);
+        next.min_brightness = def.min_brightness;
+        next.max_brightness = def.max_brightness;
         if (verbose) printf("Invalid range in config, reverting to defaults.\n");
     }
+    apply_changes(config_commit(&next));
 }
 
-
+// The config file as we last wrote it, so our own rename isn't taken for an edit
+struct stat saved_stat;
+int persist_pending = 0;
 
 void save_config() {
-    FILE *f = fopen(g_config_path, "w");
-    if (!f) {
+    persist_pending = 0;
+    if (config_save(g_config_path, config_get()) < 0) {
         if (verbose) perror("Failed to save config");
         return;
     }
+    stat(g_config_path, &saved_stat);
+    if (verbose) printf("Configuration saved to %s\n", g_config_path);
+}
 
-    fprintf(f, "# Lumos Configuration File\n\n");
-    fprintf(f, "# Minimum brightness percentage (0-100)\n");
-    fprintf(f, "min_brightness=%d\n\n", config.min_brightness);
-    fprintf(f, "# Maximum brightness percentage (0-100)\n");
-    fprintf(f, "max_brightness=%d\n\n", config.max_brightness);
-    fprintf(f, "# Update interval in seconds\n");
-    fprintf(f, "interval=%d\n\n", config.interval);
-    fprintf(f, "# Brightness Offset (Default: 0)\n");
-    fprintf(f, "brightness_offset=%d\n\n", config.brightness_offset);
-    fprintf(f, "# Brightness Sensitivity (Default: 1.0)\n");
-    fprintf(f, "sensitivity=%.2f\n\n", config.sensitivity);
-    fprintf(f, "# Mode (auto/manual)\n");
-    fprintf(f, "mode=%s\n\n", config.mode ? "manual" : "auto");
-    fprintf(f, "# Manual Brightness Value (0-100)\n");
-    fprintf(f, "manual_brightness=%d\n\n", config.manual_brightness);
-    fprintf(f, "# Camera Device (e.g. /dev/video0)\n");
-    fprintf(f, "camera_dev=%s\n", config.camera_dev);
+// PERSIST only arms this, keeping disk I/O off the request path; whatever
+// is current when it fires gets written, at most once per PERSIST_DELAY
+void on_persist_timer(Watch *w, uint32_t events);
+Watch persist_timer = { .fd = -1, .on_event = on_persist_timer };
 
-    fclose(f);
-    if (verbose) printf("Configuration saved to %s\n", g_config_path);
+// Learned curve points go out the same way, so dragging a slider doesn't
+// rewrite the curve file for every step
+int curve_pending = 0;
+
+void save_curve() {
+    curve_pending = 0;
+    if (curve_save(&curve, curve_path) < 0 && verbose) perror("Failed to save curve");
+}
+
+void request_save() {
+    if (!persist_pending && !curve_pending) timer_arm(persist_timer.fd, PERSIST_DELAY);
+    persist_pending = 1;
+}
+
+void request_curve_save() {
+    if (!persist_pending && !curve_pending) timer_arm(persist_timer.fd, PERSIST_DELAY);
+    curve_pending = 1;
+}
+
+void on_persist_timer(Watch *w, uint32_t events) {
+    if (!timer_drain(w->fd)) return;
+    if (persist_pending) save_config();
+    if (curve_pending) save_curve();
+}
+
+// Edits to the config file are picked up without SIGHUP. The directory is
+// watched rather than the file, since editors save by renaming over it.
+void on_config_event(Watch *w, uint32_t events);
+Watch config_watch = { .fd = -1, .on_event = on_config_event };
+void on_reload_timer(Watch *w, uint32_t events);
+Watch reload_timer = { .fd = -1, .on_event = on_reload_timer };
+
+int config_watch_init() {
+    char dir[512];
+    const char *slash = strrchr(g_config_path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - g_config_path) + (slash == g_config_path), g_config_path);
+
+    config_watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (config_watch.fd < 0) return -1;
+    if (inotify_add_watch(config_watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0 || watch_add(&config_watch, EPOLLIN) < 0) {
+        close(config_watch.fd);
+        config_watch.fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void on_config_event(Watch *w, uint32_t events) {
+    const char *slash = strrchr(g_config_path, '/');
+    const char *base = slash ? slash + 1 : g_config_path;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->len && strcmp(ev->name, base) == 0) timer_arm(reload_timer.fd, RELOAD_DELAY);
+        }
+    }
+}
+
+void on_reload_timer(Watch *w, uint32_t events) {
+    struct stat st;
+    if (!timer_drain(w->fd) || stat(g_config_path, &st) < 0) return;
+    if (st.st_ino == saved_stat.st_ino && st.st_mtim.tv_sec == saved_stat.st_mtim.tv_sec &&
+        st.st_mtim.tv_nsec == saved_stat.st_mtim.tv_nsec)
+        return; // Our own PERSIST
+    if (verbose) printf("%s changed, reloading\n", g_config_path);
+    load_config(g_config_path);
+}
+
+typedef struct Client {
+    Watch w;
+    struct Client *next;
+    char in[CLIENT_BUF];
+    size_t in_len;
+    char *out;
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+    int framed;     // Sent newline-terminated commands; otherwise one-shot legacy mode
+    int subscribed;
+    int want_out;
+    int closing;    // Close once the output is flushed
+    int dead;       // Closed; freed by clients_reap() once the event batch is done
+    uint64_t legacy_at; // Unterminated first command runs as a legacy one then, 0 if none
+} Client;
+
+Client *clients = NULL;
+int n_clients = 0;
+
+void client_reply(Client *c, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len < 0) return;
+
+    if (c->out_len + len + 1 > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 256;
+        while (cap < c->out_len + len + 1) cap *= 2;
+        char *out = realloc(c->out, cap);
+        if (!out) return;
+        c->out = out;
+        c->out_cap = cap;
+    }
+    va_start(args, format);
+    vsnprintf(c->out + c->out_len, len + 1, format, args);
+    va_end(args);
+    c->out_len += len;
+}
+
+int percent_of(int level) {
+    if (level < 0 || primary->max <= 0) return -1;
+    return (int)lround(level * 100.0 / primary->max);
+}
+
+// Keys GETALL reports, in order
+const char *all_keys[] = {
+    "mode", "manual_brightness", "min_brightness", "max_brightness", "interval", "interval_min",
+    "brighten_threshold", "dim_threshold", "learn_window", "brightness_offset", "sensitivity", "camera_dev",
+    "light_source", "als_dev", "als_interval_ms", "als_gain", "stream_idle", "exposure_lock", "ramp_ms",
+    "ramp_hz", "displays", "stats_file", "config_version", "camera_mode", "display_power", "sensor", "lux", "luma",
+    "luma_filtered", "sample_interval", "curve_samples", "target", "brightness", NULL
+};
+
+// Formats one value without the trailing newline; -1 for an unknown key
+int get_value(const char *key, char *buf, size_t len) {
+    const Config *cfg = config_get();
+    if (config_format(cfg, key, buf, len) == 0) return 0;
+    else if (strcmp(key, "config_version") == 0) snprintf(buf, len, "%lu", cfg->version);
+    else if (strcmp(key, "camera_mode") == 0) {
+        const CameraMode *mode = source_mode(cfg->camera_dev, 0);
+        if (mode) camera_mode_describe(mode, buf, len);
+        else snprintf(buf, len, "unknown");
+    }
+    else if (strcmp(key, "display_power") == 0) snprintf(buf, len, "%s", panel_off ? "off" : "on");
+    else if (strcmp(key, "sensor") == 0) snprintf(buf, len, "%s", last_sensor);
+    else if (strcmp(key, "lux") == 0) snprintf(buf, len, "%.1f", last_lux);
+    else if (strcmp(key, "luma") == 0) snprintf(buf, len, "%d", last_luma);
+    else if (strcmp(key, "luma_filtered") == 0)
+        snprintf(buf, len, "%.1f", tracker.primed ? tracker.estimate : -1.0);
+    else if (strcmp(key, "curve_samples") == 0) snprintf(buf, len, "%u", curve.samples);
+    else if (strcmp(key, "sample_interval") == 0) snprintf(buf, len, "%.1f", sample_interval());
+    else if (strcmp(key, "target") == 0) snprintf(buf, len, "%d", percent_of(last_target));
+    else if (strcmp(key, "brightness") == 0) snprintf(buf, len, "%d", percent_of(display_current(primary)));
+    else return -1;
+    return 0;
+}
+
+void client_kill(Client *c);
+void client_want_out(Client *c);
+
+// Pushes "EVENT <key> <value>" to every subscriber. Publishing happens in
+// the middle of handling some other event, possibly one of these clients'
+// own, so output is only queued here; the socket is written when the loop
+// reports it writable.
+void publish(const char *key) {
+    char val[128];
+    if (!clients || get_value(key, val, sizeof(val)) < 0) return;
+
+    for (Client *c = clients; c; c = c->next) {
+        if (!c->subscribed || c->dead) continue;
+        client_reply(c, "EVENT %s %s\n", key, val);
+        if (c->out_len - c->out_off > CLIENT_OUT_MAX) client_kill(c);
+        else client_want_out(c);
+    }
+}
+
+// Mirrors the live state into the shared status page
+void status_update() {
+    if (!status_page) return;
+
+    const Config *cfg = config_get();
+    LumosStatus s;
+    memset(&s, 0, sizeof(s));
+    s.pid = getpid();
+    s.sample_time_ms = last_sample_ms;
+    s.luma = last_luma;
+    s.target = percent_of(last_target);
+    s.brightness = percent_of(display_current(primary));
+    s.mode = cfg->mode;
+    s.min_brightness = cfg->min_brightness;
+    s.max_brightness = cfg->max_brightness;
+    s.interval = cfg->interval;
+    s.brightness_offset = cfg->brightness_offset;
+    s.sensitivity = cfg->sensitivity;
+    s.manual_brightness = cfg->manual_brightness;
+    s.stream_idle = cfg->stream_idle;
+    s.exposure_lock = cfg->exposure_lock;
+    s.ramp_ms = cfg->ramp_ms;
+    s.ramp_hz = cfg->ramp_hz;
+    snprintf(s.camera_dev, sizeof(s.camera_dev), "%s", cfg->camera_dev);
+    get_value("camera_mode", s.camera_mode, sizeof(s.camera_mode));
+    s.history_seq = history_last();
+    status_publish(status_page, &s);
+}
+
+// Publishes whatever changed since the last call
+void publish_state() {
+    const Config *cfg = config_get();
+    int percent = percent_of(display_current(primary));
+    if (percent != published_brightness) {
+        published_brightness = percent;
+        publish("brightness");
+    }
+    if (cfg->mode != published_mode) {
+        published_mode = cfg->mode;
+        publish("mode");
+    }
+    status_update();
+}
+
+void apply_auto(double luma);
+
+// One row per sample, for HISTORY and the TUI graph
+void record_history(int luma) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    HistoryEntry e = {
+        .time_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000,
+        .luma = luma,
+        .target = percent_of(last_target),
+        .brightness = output_count ? percent_of(ramp_destination(&outputs[0].ramp)) : -1,
+        .mode = config_get()->mode,
+    };
+    history_record(&e);
+}
+
+// "<newest seq> <time_ms>", then per entry, oldest first:
+// "+<ms since the previous>,<luma>,<target>,<brightness>,<a|m>"
+void reply_history(Client *c, uint64_t n, uint64_t after) {
+    uint64_t last = history_last();
+    uint64_t first = history_first();
+    if (after >= first) first = after + 1;
+    if (first <= last && last - first + 1 > n) first = last - n + 1;
+    if (n == 0 || first > last) {
+        client_reply(c, "%llu 0\n", (unsigned long long)last);
+        return;
+    }
+
+    int64_t prev = history_at(first)->time_ms;
+    client_reply(c, "%llu %lld", (unsigned long long)last, (long long)prev);
+    for (uint64_t seq = first; seq <= last; seq++) {
+        const HistoryEntry *e = history_at(seq);
+        client_reply(c, " +%lld,%d,%d,%d,%c", (long long)(e->time_ms - prev), e->luma, e->target, e->brightness,
+                     e->mode ? 'm' : 'a');
+        prev = e->time_ms;
+    }
+    client_reply(c, "\n");
 }
 
-void handle_client(int client_fd) {
-    char buffer[256];
-    int n = read(client_fd, buffer, sizeof(buffer) - 1);
-    if (n <= 0) return;
-    buffer[n] = '\0';
+// A manual level set soon after an auto reading says what that reading should
+// have mapped to. Later changes against the same reading (a slider being
+// dragged) revise that one point instead of piling up more.
+void learn_manual(int percent) {
+    const Config *cfg = config_get();
+    if (cfg->learn_window <= 0 || auto_readings == 0) return;
+    if (stats_now() - last_auto_ns > (uint64_t)cfg->learn_window * 1000000000ull) return;
 
-    char cmd[32], key[64], val[64];
-    int args = sscanf(buffer, "%31s %63s %63s", cmd, key, val);
+    if (learned_reading == auto_readings) curve = curve_before;
+    else curve_before = curve;
+    learned_reading = auto_readings;
 
-    char response[256] = "OK\n";
+    curve_train(&curve, last_auto_luma, percent);
+    curve_compile(&curve, cfg);
+    log_msg("Learned: luma %.1f -> %d%% (%u samples)", last_auto_luma, percent, curve.samples);
+    request_curve_save();
+}
+
+// A dragged slider sends SETs faster than anything can follow them. The first
+// of a burst is applied at once; the ones after it are folded together and
+// applied once per SET_COALESCE until a quiet one closes the window. Curve
+// changes map the last reading again, so only a camera or mode change ever
+// asks for a new one. The snapshot itself changes on every SET, so GET and
+// PERSIST never see a stale value.
+void on_apply_timer(Watch *w, uint32_t events);
+Watch apply_timer = { .fd = -1, .on_event = on_apply_timer };
+unsigned pending_changes = 0;
+int pending_learn = -1; // Manual level to learn from once the burst settles
+int coalescing = 0;
+
+void queue_changes(unsigned changed, int learn_percent) {
+    if (coalescing) {
+        pending_changes |= changed;
+        if (learn_percent >= 0) pending_learn = learn_percent;
+        return;
+    }
+    apply_changes(changed);
+    if (learn_percent >= 0) learn_manual(learn_percent);
+    coalescing = 1;
+    timer_arm(apply_timer.fd, SET_COALESCE);
+}
+
+void on_apply_timer(Watch *w, uint32_t events) {
+    if (!timer_drain(w->fd)) return;
+    if (!pending_changes && pending_learn < 0) {
+        coalescing = 0;
+        return;
+    }
+    unsigned changed = pending_changes;
+    int learn = pending_learn;
+    pending_changes = 0;
+    pending_learn = -1;
+    apply_changes(changed);
+    if (learn >= 0) learn_manual(learn);
+    timer_arm(w->fd, SET_COALESCE);
+}
+
+void dispatch_command(Client *c, const char *line) {
+    char cmd[32], key[64], val[256];
+    int args = sscanf(line, "%31s %63s %255s", cmd, key, val);
+    if (args < 1) {
+        client_reply(c, "ERR Invalid command\n");
+        return;
+    }
 
     if (strcmp(cmd, "GET") == 0 && args >= 2) {
-        if (strcmp(key, "min_brightness") == 0) sprintf(response, "%d\n", config.min_brightness);
-        else if (strcmp(key, "max_brightness") == 0) sprintf(response, "%d\n", config.max_brightness);
-        else if (strcmp(key, "interval") == 0) sprintf(response, "%d\n", config.interval);
-        else if (strcmp(key, "brightness_offset") == 0) sprintf(response, "%d\n", config.brightness_offset);
-        else if (strcmp(key, "sensitivity") == 0) sprintf(response, "%.2f\n", config.sensitivity);
-        else if (strcmp(key, "mode") == 0) sprintf(response, "%s\n", config.mode ? "manual" : "auto");
-        else if (strcmp(key, "manual_brightness") == 0) sprintf(response, "%d\n", config.manual_brightness);
-        else if (strcmp(key, "camera_dev") == 0) sprintf(response, "%s\n", config.camera_dev);
-        else strcpy(response, "ERR Unknown key\n");
+        char buf[256];
+        if (get_value(key, buf, sizeof(buf)) == 0) client_reply(c, "%s\n", buf);
+        else client_reply(c, "ERR Unknown key\n");
     } 
-    else if (strcmp(cmd, "SET") == 0 && args >= 3) {
-        if (strcmp(key, "min_brightness") == 0) config.min_brightness = atoi(val);
-        else if (strcmp(key, "max_brightness") == 0) config.max_brightness = atoi(val);
-        else if (strcmp(key, "interval") == 0) config.interval = atoi(val);
-        else if (strcmp(key, "brightness_offset") == 0) config.brightness_offset = atoi(val);
-        else if (strcmp(key, "sensitivity") == 0) config.sensitivity = atof(val);
-        else if (strcmp(key, "mode") == 0) {
-             if (strcmp(val, "manual") == 0 || strcmp(val, "1") == 0) config.mode = 1;
-             else config.mode = 0;
-        }
-        else if (strcmp(key, "brightness") == 0 || strcmp(key, "manual_brightness") == 0) {
-            config.manual_brightness = atoi(val);
-            config.mode = 1; // Auto-switch to manual
+    else if (strcmp(cmd, "GETALL") == 0) {
+        char buf[256];
+        for (int i = 0; all_keys[i]; i++) {
+            get_value(all_keys[i], buf, sizeof(buf));
+            client_reply(c, "%s%s=%s", i ? " " : "", all_keys[i], buf);
         }
-        else if (strcmp(key, "camera_dev") == 0) {
-             strncpy(config.camera_dev, val, sizeof(config.camera_dev) - 1);
+        client_reply(c, "\n");
+    }
+    else if (strcmp(cmd, "SUBSCRIBE") == 0) {
+        c->subscribed = 1;
+        client_reply(c, "OK\n");
+    }
+    else if (strcmp(cmd, "SET") == 0 && args >= 3) {
+        // Validate on a copy; the running snapshot only changes if it all checks out
+        Config next = *config_get();
+        int manual = strcmp(key, "brightness") == 0 || strcmp(key, "manual_brightness") == 0;
+        int rc = config_set(&next, manual ? "manual_brightness" : key, val);
+        if (rc == 0 && manual) next.mode = 1; // Auto-switch to manual
+        if (rc == 0 && config_check(&next) < 0) rc = -2;
+
+        if (rc == -1) client_reply(c, "ERR Unknown key\n");
+        else if (rc < 0) client_reply(c, "ERR Invalid value\n");
+        else {
+            client_reply(c, "OK\n");
+            queue_changes(config_commit(&next), manual ? next.manual_brightness : -1);
+            status_update(); // Like GET, the page shows the SET at once, not when it is applied
         }
-        else strcpy(response, "ERR Unknown key\n");
-        
-        // Signal main thread to update brightness immediately
-        pthread_mutex_lock(&wake_mutex);
-        pthread_cond_signal(&wake_cond);
-        pthread_mutex_unlock(&wake_mutex);
     } 
     else if (strcmp(cmd, "PERSIST") == 0) {
-        save_config();
-        strcpy(response, "SAVED\n");
+        request_save();
+        client_reply(c, "SAVED\n");
     } 
+    else if (strcmp(cmd, "CURVE") == 0) {
+        if (args >= 2 && strcmp(key, "RESET") == 0) {
+            curve_reset(&curve);
+            learned_reading = 0;
+            curve_compile(&curve, config_get());
+            save_curve();
+            if (config_get()->mode == 0 && tracker.primed) apply_auto(tracker.estimate);
+            publish_state();
+            client_reply(c, "OK\n");
+        } else {
+            char buf[512];
+            curve_format(&curve, buf, sizeof(buf));
+            client_reply(c, "%s\n", buf);
+        }
+    }
+    else if (strcmp(cmd, "CALIBRATE") == 0) {
+        if (calibrate_request() < 0) client_reply(c, "ERR no light sensor\n");
+        else client_reply(c, "OK\n");
+    }
+    else if (strcmp(cmd, "HISTORY") == 0) {
+        uint64_t n = args >= 2 ? strtoull(key, NULL, 10) : HISTORY_LEN;
+        uint64_t after = args >= 3 ? strtoull(val, NULL, 10) : 0;
+        reply_history(c, n, after);
+    }
+    else if (strcmp(cmd, "DISPLAYS") == 0) {
+        for (int i = 0; i < output_count; i++) {
+            Display *d = &outputs[i].dev;
+            client_reply(c, "%s%s=%d/%d", i ? " " : "", d->name, display_current(d), d->max);
+        }
+        client_reply(c, "\n");
+    }
+    else if (strcmp(cmd, "STATS") == 0) {
+        char buf[2048];
+        stats_format(buf, sizeof(buf));
+        client_reply(c, "%s\n", buf);
+    }
     else {
-        strcpy(response, "ERR Invalid command\n");
+        client_reply(c, "ERR Invalid command\n");
+    }
+}
+
+void handle_command(Client *c, const char *line) {
+    uint64_t t0 = stats_now();
+    dispatch_command(c, line);
+    stats_count(COUNT_IPC_COMMANDS);
+    stats_record(STAGE_IPC, t0);
+}
+
+// Stops watching the client but leaves it allocated: an event for it may
+// still be waiting further down the current epoll batch
+void client_kill(Client *c) {
+    if (c->dead) return;
+    c->dead = 1;
+    watch_del(&c->w);
+}
+
+// Frees the clients killed while handling the last batch of events
+void clients_reap() {
+    Client **pp = &clients;
+    while (*pp) {
+        Client *c = *pp;
+        if (!c->dead) {
+            pp = &c->next;
+            continue;
+        }
+        *pp = c->next;
+        close(c->w.fd);
+        free(c->out);
+        free(c);
+        n_clients--;
+    }
+}
+
+void client_want_out(Client *c) {
+    if (c->want_out) return;
+    c->want_out = 1;
+    watch_mod(&c->w, EPOLLOUT);
+}
+
+// Returns 0 once everything is written, 1 if the socket is full, -1 on error
+int client_flush(Client *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->w.fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_off += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) return 1;
+        return -1;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+// Flushes output and picks what to wait for next; may kill the client
+void client_update(Client *c) {
+    int rc = client_flush(c);
+    if (rc < 0 || (rc == 0 && c->closing) || c->out_len - c->out_off > CLIENT_OUT_MAX) {
+        client_kill(c);
+        return;
+    }
+    // Stop reading while output is backed up, so a client can't queue unbounded replies
+    int want_out = rc == 1;
+    if (want_out != c->want_out) {
+        c->want_out = want_out;
+        watch_mod(&c->w, want_out ? EPOLLOUT : EPOLLIN);
+    }
+}
+
+// Runs every complete line in the input buffer
+void client_process(Client *c) {
+    char *start = c->in;
+    char *nl;
+    while (!c->closing && !c->dead && (nl = memchr(start, '\n', c->in + c->in_len - start))) {
+        *nl = '\0';
+        if (nl > start && nl[-1] == '\r') nl[-1] = '\0';
+        if (*start) handle_command(c, start);
+        start = nl + 1;
+    }
+    c->in_len -= start - c->in;
+    memmove(c->in, start, c->in_len);
+
+    if (c->in_len == sizeof(c->in) - 1) {
+        client_reply(c, "ERR Line too long\n");
+        c->closing = 1;
+    }
+}
+
+// Whether a client speaks the line protocol is only known once it sends a
+// newline. Until then its input may be the start of a line split across
+// reads, so a bare legacy command runs on EOF, when the buffer fills, or
+// after LEGACY_QUIET with nothing more arriving.
+void on_legacy_timer(Watch *w, uint32_t events);
+Watch legacy_timer = { .fd = -1, .on_event = on_legacy_timer };
+
+void legacy_rearm() {
+    uint64_t next = 0;
+    for (Client *c = clients; c; c = c->next) {
+        if (!c->dead && c->legacy_at && (!next || c->legacy_at < next)) next = c->legacy_at;
+    }
+    if (!next) {
+        timer_disarm(legacy_timer.fd);
+        return;
+    }
+    uint64_t now = stats_now();
+    timer_arm(legacy_timer.fd, next > now ? (next - now) / 1e9 : 0);
+}
+
+// Legacy client: one bare command, one reply, then close
+void legacy_run(Client *c) {
+    c->legacy_at = 0;
+    handle_command(c, c->in);
+    c->closing = 1;
+}
+
+void on_legacy_timer(Watch *w, uint32_t events) {
+    if (!timer_drain(w->fd)) return;
+    uint64_t now = stats_now();
+    for (Client *c = clients; c; c = c->next) {
+        if (c->dead || !c->legacy_at || c->legacy_at > now) continue;
+        legacy_run(c);
+        client_update(c);
+    }
+    legacy_rearm();
+}
+
+void on_client_event(Watch *w, uint32_t events) {
+    Client *c = (Client *)w;
+    if (c->dead) return;
+
+    if (events & EPOLLIN) {
+        while (!c->closing && !c->dead) {
+            ssize_t n = read(c->w.fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+            if (n > 0) {
+                c->in_len += n;
+                c->in[c->in_len] = '\0';
+                if (!c->framed && !memchr(c->in, '\n', c->in_len)) {
+                    if (c->in_len == sizeof(c->in) - 1) {
+                        legacy_run(c);
+                        break;
+                    }
+                    c->legacy_at = stats_now() + (uint64_t)(LEGACY_QUIET * 1e9);
+                    legacy_rearm();
+                    continue;
+                }
+                if (!c->framed && c->legacy_at) {
+                    c->legacy_at = 0;
+                    legacy_rearm();
+                }
+                c->framed = 1;
+                client_process(c);
+            } else if (n == 0) {
+                if (!c->framed && c->in_len) legacy_run(c);
+                c->closing = 1;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN) {
+                break;
+            } else {
+                client_kill(c);
+                return;
+            }
+        }
+    } else if (events & (EPOLLHUP | EPOLLERR)) {
+        client_kill(c);
+        return;
     }
 
-    write(client_fd, response, strlen(response));
-    close(client_fd);
+    if (!c->dead) client_update(c);
 }
 
-void *socket_thread(void *arg) {
-    int server_fd, client_fd;
+void on_listen_event(Watch *w, uint32_t events) {
+    while (1) {
+        int fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN or a transient accept error
+        }
+        if (n_clients >= MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+
+        Client *c = calloc(1, sizeof(Client));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->w.fd = fd;
+        c->w.on_event = on_client_event;
+        if (watch_add(&c->w, EPOLLIN) == -1) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = clients;
+        clients = c;
+        n_clients++;
+    }
+}
+
+Watch listen_watch = { .fd = -1, .on_event = on_listen_event };
+
+int socket_inherited = 0;
+
+int socket_init() {
     struct sockaddr_un addr;
 
-    unlink(SOCKET_PATH);
-    if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    // Socket activation: systemd made the socket (and owns the path) before we started
+    int server_fd = systemd_listen_fd();
+    if (server_fd >= 0) {
+        socket_inherited = 1;
+        listen_watch.fd = server_fd;
+        return watch_add(&listen_watch, EPOLLIN);
+    }
+
+    size_t path_len = strlen(socket_path);
+    if (path_len >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+
+    unlink(socket_path);
+    server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd == -1) {
         perror("Socket error");
-        return NULL;
+        return -1;
     }
 
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path)-1);
+    memcpy(addr.sun_path, socket_path, path_len + 1);
 
     if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         perror("Bind error");
-        return NULL;
+        close(server_fd);
+        return -1;
     }
 
     // Allow all users to access the socket (so the applet can talk to us)
-    chmod(SOCKET_PATH, 0666);
+    chmod(socket_path, 0666);
 
-    if (listen(server_fd, 5) == -1) {
+    if (listen(server_fd, 16) == -1) {
         perror("Listen error");
-        return NULL;
+        close(server_fd);
+        return -1;
     }
 
-    while (1) {
-        client_fd = accept(server_fd, NULL, NULL);
-        if (client_fd == -1) continue;
-        handle_client(client_fd);
+    listen_watch.fd = server_fd;
+    return watch_add(&listen_watch, EPOLLIN);
+}
+
+
+void on_ramp_event(Watch *w, uint32_t events) {
+    Output *o = (Output *)((char *)w - offsetof(Output, ramp_w));
+    ramp_tick(&o->ramp);
+    publish_state();
+}
+
+// Keeps the cached level in sync when hotkeys or other tools change it
+void on_notify_event(Watch *w, uint32_t events) {
+    Output *o = (Output *)((char *)w - offsetof(Output, notify_w));
+    int before = display_current(&o->dev);
+    int now = display_read(&o->dev);
+    if (now >= 0 && now != before) log_msg("%s changed: %d -> %d", o->dev.name, before, now);
+    publish_state();
+}
+
+// Sends a brightness percentage to every display through its own curve
+void outputs_apply(double percent) {
+    if (percent != last_percent) state_dirty = 1;
+    last_percent = percent;
+    for (int i = 0; i < output_count; i++) {
+        Output *o = &outputs[i];
+        ramp_set_target(&o->ramp, display_level(&o->dev, percent));
     }
 }
 
-void log_msg(const char *format, ...) {
-    if (!verbose) return;
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
-    printf("\n");
+// Waits for slow displays to take their last level
+void outputs_close() {
+    for (int i = 0; i < output_count; i++) {
+        Output *o = &outputs[i];
+        if (o->notify_w.fd >= 0) watch_del(&o->notify_w);
+        watch_del(&o->ramp_w);
+        ramp_close(&o->ramp);
+        display_close(&o->dev);
+    }
+    output_count = 0;
 }
 
+// Opens every display the config names; returns how many
+int outputs_open() {
+    const Config *cfg = config_get();
+    char specs[DISPLAY_MAX][DISPLAY_SPEC_LEN];
+    int n = display_expand(cfg->displays, backlight_class, specs, DISPLAY_MAX);
 
-int find_backlight_driver() {
-    DIR *d;
-    struct dirent *dir;
-    d = opendir("/sys/class/backlight");
-    if (!d) return 0;
+    for (int i = 0; i < n; i++) {
+        Output *o = &outputs[output_count];
+        if (display_open(&o->dev, specs[i]) < 0) {
+            fprintf(stderr, "Warning: Cannot open display %s\n", specs[i]);
+            continue;
+        }
+        if (ramp_init(&o->ramp, &o->dev) < 0) {
+            display_close(&o->dev);
+            continue;
+        }
+        ramp_configure(&o->ramp, cfg->ramp_ms, cfg->ramp_hz);
+        o->ramp_w = (Watch){ .fd = ramp_fd(&o->ramp), .on_event = on_ramp_event };
+        watch_add(&o->ramp_w, EPOLLIN);
 
-    while ((dir = readdir(d)) != NULL) {
-        if (dir->d_name[0] == '.') continue;
-        snprintf(backlight_path, sizeof(backlight_path), "/sys/class/backlight/%s", dir->d_name);
-        closedir(d);
-        return 1;
+        // sysfs raises POLLPRI on change; a plain file (or an old driver) just can't be watched
+        o->notify_w = (Watch){ .fd = display_notify_fd(&o->dev), .on_event = on_notify_event };
+        if (o->notify_w.fd >= 0 && watch_add(&o->notify_w, EPOLLPRI) == -1) o->notify_w.fd = -1;
+
+        log_msg("Display: %s (%s, max %d)", o->dev.name, o->dev.spec, o->dev.max);
+        output_count++;
+    }
+    return output_count;
+}
+
+// Only touched from the main loop
+FrameSource camera = { .fd = -1 };
+
+// Keep the session open only if the next sample will arrive before it idles out
+int camera_keepalive() {
+    const Config *cfg = config_get();
+    return cfg->stream_idle > 0 && tracker_interval(&tracker, cfg) <= cfg->stream_idle;
+}
+
+// Exposure the last locked sample ended on; the next one starts there
+long exposure_hint = 0;
+
+// A sample in flight. Frames are metered one at a time as the camera fd
+// becomes readable, so IPC keeps flowing while the camera warms up.
+typedef struct {
+    Watch w;
+    int active;
+    int locked;      // Metering at a fixed exposure
+    int frames;
+    int max_frames;
+    int settled;
+    int discard;     // Frames still exposed with a superseded setting
+    int steps;
+    double prev;
+    uint64_t started;
+    uint64_t last_frame;
+} Capture;
+
+void on_camera_event(Watch *w, uint32_t events);
+void on_capture_timer(Watch *w, uint32_t events);
+
+Capture capture = { .w = { .fd = -1, .on_event = on_camera_event } };
+// Deadline for the next frame of the sample in flight
+Watch capture_timer = { .fd = -1, .on_event = on_capture_timer };
+int capture_failures = 0;   // In a row; drives the retry backoff
+double capture_backoff = 0; // Seconds until the camera is tried again, 0 when healthy
+int camera_busy = 0;
+void on_idle_timer(Watch *w, uint32_t events);
+Watch idle_timer = { .fd = -1, .on_event = on_idle_timer };
+
+void schedule_next();
+
+// Ambient light sensor, when light_source allows one and it opened
+Als als = { .fd_value = -1, .fd_buffer = -1 };
+char als_spec[128];         // What als was opened from
+int calibrate_pending = 0;  // Take the next reading with the camera to calibrate the ALS
+
+int als_active() {
+    return config_get()->light_source != LIGHT_CAMERA && als_is_open(&als) && !calibrate_pending;
+}
+
+// Opens, switches or drops the sensor to match the config
+void als_update() {
+    const Config *cfg = config_get();
+    int wanted = cfg->light_source != LIGHT_CAMERA;
+    if (wanted && als_is_open(&als) && strcmp(als_spec, cfg->als_dev) == 0) return;
+
+    als_close(&als);
+    if (!wanted) return;
+    snprintf(als_spec, sizeof(als_spec), "%s", cfg->als_dev);
+    if (als_open(&als, cfg->als_dev) < 0 && cfg->light_source == LIGHT_ALS)
+        fprintf(stderr, "Warning: No ambient light sensor at %s\n", cfg->als_dev);
+}
+
+// Next auto sample goes to the camera, and the sensor is matched to it
+int calibrate_request() {
+    if (config_get()->light_source == LIGHT_CAMERA || !als_is_open(&als)) return -1;
+    calibrate_pending = 1;
+    if (!capture.active) schedule_sample(0);
+    return 0;
+}
+
+void capture_end() {
+    if (capture.w.fd >= 0) watch_del(&capture.w);
+    capture.w.fd = -1;
+    capture.active = 0;
+    timer_disarm(capture_timer.fd);
+}
+
+// Backs off RETRY_MIN, twice that, ... up to RETRY_MAX; a camera held by
+// another application (a video call) is left alone for BUSY_DEFER instead
+void capture_failed(int busy) {
+    source_close(&camera);
+    calibrate_pending = 0;
+    if (busy) {
+        stats_count(COUNT_CAPTURE_BUSY);
+        if (!camera_busy) log_msg("Camera in use by another application; checking every %.0f s", BUSY_DEFER);
+        camera_busy = 1;
+        capture_backoff = BUSY_DEFER;
+        return;
+    }
+    stats_count(COUNT_CAPTURE_FAILURES);
+    capture_failures++;
+    capture_backoff = RETRY_MIN * pow(2.0, capture_failures - 1);
+    if (capture_backoff > RETRY_MAX) capture_backoff = RETRY_MAX;
+    log_msg("Warning: Failed to capture from camera (retry in %.0f s).", capture_backoff);
+}
+
+int capture_start() {
+    const Config *cfg = config_get();
+    int fresh = 0;
+
+    if (source_is_open(&camera) && strcmp(camera.spec, cfg->camera_dev) == 0) {
+        // Stream is already running; just skip stale frames
+        source_flush(&camera);
+    } else {
+        source_close(&camera);
+        if (source_open(&camera, cfg->camera_dev) < 0) return -1;
+        fresh = 1;
+    }
+
+    capture.frames = 0;
+    capture.settled = 0;
+    capture.discard = 0;
+    capture.steps = 0;
+    capture.prev = -1.0;
+
+    int was_locked = source_exposure(&camera)->locked;
+    if (cfg->exposure_lock && source_exposure_lock(&camera, exposure_hint) == 0) {
+        capture.locked = 1;
+        // The frame already in flight was exposed with the old setting
+        capture.discard = was_locked ? 0 : 1;
+    } else {
+        capture.locked = 0;
+        if (was_locked) {
+            source_exposure_unlock(&camera);
+            fresh = 1;
+        }
+    }
+    // A running stream has settled already; confirm with a couple of frames
+    capture.max_frames = fresh ? WARMUP_MAX_FRAMES : CONVERGE_FRAMES + 1;
+
+    capture.started = capture.last_frame = stats_now();
+    capture.w.fd = camera.fd;
+    if (watch_add(&capture.w, EPOLLIN) == -1) {
+        capture.w.fd = -1;
+        source_close(&camera);
+        return -1;
+    }
+    capture.active = 1;
+    timer_arm(capture_timer.fd, fresh ? FIRST_FRAME_TIMEOUT : FRAME_TIMEOUT);
+    return 0;
+}
+
+// Auto-exposure: keep reading until the mean stops moving, up to the cap
+int meter_converged(const LumaStats *stats, double *luma) {
+    capture.frames++;
+    if (capture.prev >= 0.0 && fabs(stats->mean - capture.prev) <= CONVERGE_DELTA) capture.settled++;
+    else capture.settled = 0;
+    capture.prev = stats->mean;
+
+    if (capture.settled < CONVERGE_FRAMES && capture.frames < capture.max_frames) return 0;
+
+    log_msg("AE: %d frame(s)%s, mean %.1f, min %u, max %u", capture.frames,
+            capture.settled >= CONVERGE_FRAMES ? "" : " (cap)", stats->mean, stats->min, stats->max);
+    *luma = stats->mean;
+    return 1;
+}
+
+// Locked exposure: one frame is enough unless it clips, in which case step the
+// exposure and scale the reading back to the driver's default exposure
+int meter_locked(const LumaStats *stats, double *luma) {
+    const CameraExposure *e = source_exposure(&camera);
+
+    if (capture.discard > 0) {
+        capture.discard--;
+        return 0;
+    }
+
+    long next = e->value;
+    if (stats->mean > LUMA_CLIPPED_HIGH && e->value > e->min) next = e->value / 2;
+    else if (stats->mean < LUMA_CLIPPED_LOW && e->value < e->max) next = e->value * 2;
+    if (next != e->value && capture.steps < EXPOSURE_STEPS && source_exposure_set(&camera, next) == 0) {
+        capture.steps++;
+        capture.discard = 1;
+        return 0;
+    }
+
+    exposure_hint = e->value;
+    *luma = stats->mean * (double)e->ref / (double)(e->value > 0 ? e->value : 1);
+    log_msg("Locked: exposure %ld/%ld, mean %.1f -> %.1f", e->value, e->ref, stats->mean, *luma);
+    return 1;
+}
+
+// Feeds one ambient reading, on the camera's 0-255 luma scale, to the control loop
+void process_reading(double luma, const char *sensor) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    last_sample_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    last_sensor = sensor;
+
+    tracker_update(&tracker, config_get(), luma, stats_now() / 1e9);
+    if ((int)lround(luma) != last_luma) {
+        last_luma = (int)lround(luma);
+        publish("luma");
+    }
+    if (config_get()->mode == 0) {
+        auto_readings++;
+        last_auto_ns = stats_now();
+        last_auto_luma = tracker.estimate;
+    }
+    apply_auto(tracker.estimate);
+    record_history(last_luma);
+    publish_state();
+}
+
+// Sets als_gain so the sensor reads what the camera just saw
+void calibrate_als(int luma) {
+    calibrate_pending = 0;
+    double lux = als_read(&als);
+    double gain = lux >= 0.0 ? als_gain_for(lux, luma) : -1.0;
+    char val[32];
+    snprintf(val, sizeof(val), "%.3f", gain);
+    Config next = *config_get();
+    if (config_set(&next, "als_gain", val) < 0) {
+        log_msg("Calibration skipped: %.1f lux vs luma %d", lux, luma);
+        return;
+    }
+    log_msg("Calibrated: %.1f lux = luma %d (gain %s)", lux, luma, val);
+    apply_changes(config_commit(&next));
+}
+
+// Reads the ALS; -1 if it failed
+int sample_als() {
+    uint64_t t0 = stats_now();
+    double lux = als_read(&als);
+    if (lux < 0.0) return -1;
+
+    stats_record(STAGE_SAMPLE, t0);
+    stats_count(COUNT_SAMPLES);
+    if (lux != last_lux) {
+        last_lux = lux;
+        publish("lux");
     }
-    closedir(d);
+    process_reading(als_luma(lux, config_get()->als_gain), "als");
     return 0;
 }
 
-int read_int(const char *filename) {
-    char path[1024];
-    snprintf(path, sizeof(path), "%s/%s", backlight_path, filename);
-    FILE *f = fopen(path, "r");
+void capture_finish(int luma) {
+    capture_end();
+
+    if (luma >= 0) {
+        stats_record(STAGE_SAMPLE, capture.started);
+        stats_count(COUNT_SAMPLES);
+
+        if (camera_busy || capture_failures) log_msg("Camera recovered");
+        capture_failures = 0;
+        capture_backoff = 0;
+        camera_busy = 0;
+
+        if (calibrate_pending) calibrate_als(luma);
+        process_reading(luma, "camera");
+        source_touch(&camera);
+        if (!camera_keepalive()) source_close(&camera);
+    } else {
+        capture_failed(0);
+    }
+    schedule_next();
+}
+
+// Nothing from the camera in time: a wedged device must not hold the sample forever
+void on_capture_timer(Watch *w, uint32_t events) {
+    if (!timer_drain(w->fd) || !capture.active) return;
+    stats_count(COUNT_CAPTURE_TIMEOUTS);
+    log_msg("Warning: Camera delivered no frame within %.0f s.", capture.frames ? FRAME_TIMEOUT : FIRST_FRAME_TIMEOUT);
+    capture_finish(-1);
+}
+
+void on_camera_event(Watch *w, uint32_t events) {
+    CameraFrame frame;
+    int rc;
+
+    while (capture.active && (rc = source_dequeue(&camera, &frame)) != 0) {
+        if (rc < 0) {
+            capture_finish(-1);
+            return;
+        }
+
+        stats_record(STAGE_FRAME_WAIT, capture.last_frame);
+        stats_count(COUNT_FRAMES);
+
+        LumaStats stats;
+        int ok = 1;
+        uint64_t t0 = stats_now();
+        if (camera.mode.pixelformat == V4L2_PIX_FMT_MJPEG) ok = luma_stats_mjpeg(frame.data, frame.bytesused, &stats) == 0;
+        else luma_stats_yuyv(frame.data, frame.bytesused, &stats);
+        stats_record(STAGE_LUMA, t0);
+        source_requeue(&camera, &frame);
+        capture.last_frame = stats_now();
+        timer_arm(capture_timer.fd, FRAME_TIMEOUT);
+        if (!ok) {
+            // USB cameras do drop the odd packet; the next frame will do
+            stats_count(COUNT_FRAMES_CORRUPT);
+            continue;
+        }
+
+        double luma;
+        int done = capture.locked ? meter_locked(&stats, &luma) : meter_converged(&stats, &luma);
+        if (done) {
+            if (luma > 255.0) luma = 255.0;
+            capture_finish((int)luma);
+            return;
+        }
+    }
+}
+
+void set_target(int target) {
+    if (target != last_target) {
+        last_target = target;
+        publish("target");
+    }
+}
+
+void apply_manual() {
+    const Config *cfg = config_get();
+    if (output_count == 0) return;
+
+    int max_b = primary->max;
+    int cur_b = ramp_destination(&outputs[0].ramp);
+    int target = display_level(primary, cfg->manual_brightness);
+    set_target(target);
+    if (abs(cur_b - target) > (max_b * 0.01)) { // Tighter tolerance for manual
+        if (verbose) printf("Manual: %d%%\n", cfg->manual_brightness);
+        outputs_apply(cfg->manual_brightness);
+    }
+    publish_state();
+}
+
+void apply_auto(double luma) {
+    const Config *cfg = config_get();
+    if (cfg->mode == 1) return; // Switched to manual while we were capturing
+    if (output_count == 0) return;
+
+    int max_b = primary->max;
+    int cur_b = ramp_destination(&outputs[0].ramp);
+
+    double percent = control_auto_percent(cfg, &curve, luma);
+    int target = display_level(primary, percent);
+    set_target(target);
+
+    if (control_should_move(cfg, cur_b, target, max_b)) {
+        log_msg("Ambient: %.1f -> Target: %d", luma, target);
+        outputs_apply(percent);
+    }
+}
+
+// Restart fast: the level the displays were last sent is put back before the
+// camera has taken its first sample
+int load_state(double *percent) {
+    FILE *f = fopen(state_path, "r");
     if (!f) return -1;
-    int val;
-    if (fscanf(f, "%d", &val) != 1) val = -1;
+    int version;
+    int ok = fscanf(f, STATE_MAGIC " %d %lf", &version, percent) == 2 && version == STATE_VERSION &&
+             *percent >= 0.0 && *percent <= 100.0;
     fclose(f);
-    return val;
+    return ok ? 0 : -1;
 }
 
-void write_int(const char *filename, int val) {
-    char path[1024];
-    snprintf(path, sizeof(path), "%s/%s", backlight_path, filename);
-    FILE *f = fopen(path, "w");
+// Throttled to STATE_SAVE_PERIOD unless forced (at shutdown)
+void save_state(int force) {
+    if (!state_dirty || last_percent < 0.0) return;
+    uint64_t now = stats_now();
+    if (!force && last_state_save && now - last_state_save < STATE_SAVE_PERIOD * 1000000000ull) return;
+    last_state_save = now;
+    state_dirty = 0;
+
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", state_path);
+    FILE *f = fopen(tmp, "w");
     if (!f) {
-        if (verbose) perror("Failed to write brightness");
+        if (verbose) perror("Failed to save state");
         return;
     }
-    fprintf(f, "%d", val);
-    fclose(f);
+    fprintf(f, STATE_MAGIC " %d %.2f\n", STATE_VERSION, last_percent);
+    if (fclose(f) != 0 || rename(tmp, state_path) != 0) {
+        if (verbose) perror("Failed to save state");
+        remove(tmp);
+    }
+}
+
+uint64_t last_export = 0;
+
+void export_stats() {
+    const Config *cfg = config_get();
+    if (!cfg->stats_file[0]) return;
+
+    uint64_t now = stats_now();
+    if (last_export && now - last_export < STATS_EXPORT_PERIOD * 1000000000ull) return;
+    last_export = now;
+    if (stats_export(cfg->stats_file) < 0 && verbose) perror("Failed to export stats");
+}
+
+// Display power: nothing is sampled while every display is dark (blanked, DPMS
+// off) or the machine is going to sleep; the first check that finds one lit
+// again, or a resume, samples at once instead of after a full interval.
+// Connector hotplug and backlight changes arrive as kernel uevents and are
+// checked at once, but DPMS and bl_power changes raise no event and sysfs
+// doesn't notify on them, so those still need polling; the poll backs off
+// while the state holds.
+void on_power_timer(Watch *w, uint32_t events);
+Watch power_timer = { .fd = -1, .on_event = on_power_timer };
+void on_uevent(Watch *w, uint32_t events);
+Watch uevent_watch = { .fd = -1, .on_event = on_uevent };
+int suspending = 0;    // Between the sleep hook's SIGUSR1 and the resume
+int64_t asleep_ns = 0; // Time spent suspended so far, as of the last check
+double power_poll = POWER_POLL;
+
+int64_t suspended_ns() {
+    struct timespec boot, mono;
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return (int64_t)(boot.tv_sec - mono.tv_sec) * 1000000000 + (boot.tv_nsec - mono.tv_nsec);
+}
+
+// DRM connectors know about every screen; bl_power only about panels
+int displays_lit() {
+    int drm = drm_displays_on(drm_class);
+    if (drm >= 0) return drm;
+    int blanked = 0;
+    for (int i = 0; i < output_count; i++) {
+        int p = display_powered(&outputs[i].dev);
+        if (p == 1) return 1;
+        if (p == 0) blanked = 1;
+    }
+    return !blanked;
+}
+
+void panel_dark(const char *why) {
+    if (panel_off) return;
+    panel_off = 1;
+    power_poll = POWER_POLL;
+    log_msg("Sampling paused: %s", why);
+    capture_end();
+    source_close(&camera);
+    timer_disarm(sample_timer.fd);
+}
+
+void panel_lit(const char *why) {
+    panel_off = 0;
+    power_poll = POWER_POLL;
+    log_msg("Sampling resumed: %s", why);
+    capture_end();
+    source_close(&camera); // A stream from before a suspend may not deliver again
+    schedule_sample(0);
 }
 
-int capture_luma() {
-    int fd = open(config.camera_dev, O_RDWR);
-    if (fd < 0) {
-        if (verbose) perror("Camera open failed");
+void on_power_timer(Watch *w, uint32_t events) {
+    if (!timer_drain(w->fd)) return;
+    int64_t asleep = suspended_ns();
+    int woke = asleep - asleep_ns > (int64_t)(SLEEP_GAP * 1e9);
+    asleep_ns = asleep;
+    if (woke) suspending = 0; // In case the hook's SIGUSR2 never comes
+
+    if (suspending || !displays_lit()) panel_dark(suspending ? "suspending" : "displays off");
+    else if (panel_off || woke) panel_lit(woke ? "woke from suspend" : "displays on");
+    timer_arm(w->fd, power_poll);
+    power_poll = fmin(power_poll * 2, POWER_POLL_MAX);
+}
+
+// Kernel uevents, for drm and backlight changes
+int uevent_init() {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) return -1;
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // Straight from the kernel, not udev's rebroadcast
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
         return -1;
     }
+    uevent_watch.fd = fd;
+    if (watch_add(&uevent_watch, EPOLLIN) < 0) {
+        close(fd);
+        uevent_watch.fd = -1;
+        return -1;
+    }
+    return 0;
+}
 
-    struct v4l2_format fmt = {0};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = WIDTH;
-    fmt.fmt.pix.height = HEIGHT;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    
-    if (ioctl(fd, VIDIOC_S_FMT, &fmt) == -1) {
-        close(fd); return -1;
-    }
-
-    struct v4l2_requestbuffers req = {0};
-    req.count = 1;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    ioctl(fd, VIDIOC_REQBUFS, &req);
-
-    struct v4l2_buffer buf = {0};
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    buf.index = 0;
-    ioctl(fd, VIDIOC_QUERYBUF, &buf);
-
-    void *buffer_start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-    if (buffer_start == MAP_FAILED) { close(fd); return -1; }
-
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ioctl(fd, VIDIOC_STREAMON, &type);
-
-    long total_y = 0;
-    int pixel_count = 0;
-
-    for (int i = 0; i <= WARMUP_FRAMES; i++) {
-        ioctl(fd, VIDIOC_QBUF, &buf);
-        ioctl(fd, VIDIOC_DQBUF, &buf);
-        
-        if (i == WARMUP_FRAMES) {
-            unsigned char *data = (unsigned char *)buffer_start;
-            for (unsigned int j = 0; j < buf.bytesused; j += 20) {
-                total_y += data[j];
-                pixel_count++;
-            }
+void on_uevent(Watch *w, uint32_t events) {
+    char buf[8192];
+    int relevant = 0;
+    ssize_t n;
+    while ((n = recv(w->fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        // "ACTION@DEVPATH", then "KEY=VALUE" strings, all NUL-terminated
+        buf[n] = '\0';
+        for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+            if (strcmp(p, "SUBSYSTEM=drm") == 0 || strcmp(p, "SUBSYSTEM=backlight") == 0) relevant = 1;
+        }
+    }
+    if (!relevant) return;
+    power_poll = POWER_POLL;
+    timer_arm(power_timer.fd, 0);
+}
+
+// Manual mode only re-asserts the level; auto mode follows the light
+double sample_interval() {
+    const Config *cfg = config_get();
+    if (cfg->mode == 1) return cfg->interval;
+    if (als_active()) return cfg->als_interval_ms / 1000.0;
+    if (capture_backoff > 0.0) return capture_backoff;
+    return tracker_interval(&tracker, cfg);
+}
+
+void schedule_next() {
+    const Config *cfg = config_get();
+    if (!panel_off || cfg->mode == 1) schedule_sample(sample_interval());
+    export_stats();
+    save_state(0);
+
+    // Release an idle camera once stream_idle has passed without a sample
+    if (source_is_open(&camera)) {
+        double idle_left = cfg->stream_idle - source_idle_seconds(&camera);
+        timer_arm(idle_timer.fd, idle_left);
+    }
+}
+
+void run_cycle() {
+    const Config *cfg = config_get();
+    if (capture.active) {
+        // Mode or capture settings changed under the sample in flight; its reading is moot
+        log_msg("Capture cancelled");
+        capture_end();
+    }
+
+    if (cfg->mode == 0 && panel_off) return; // The power check restarts sampling
+
+    if (cfg->mode == 1) {
+        // MANUAL MODE
+        source_close(&camera);
+        apply_manual();
+        record_history(-1);
+        publish_state();
+        schedule_next();
+        return;
+    }
+
+    // AUTO MODE: the sensor is cheap enough to read every time; the camera
+    // only fills in when there is none, it fails, or CALIBRATE asks for it
+    if (als_active()) {
+        source_close(&camera);
+        if (sample_als() == 0) {
+            schedule_next();
+            return;
         }
+        log_msg("Warning: Failed to read the ambient light sensor.");
     }
-    
-    ioctl(fd, VIDIOC_STREAMOFF, &type);
-    munmap(buffer_start, buf.length);
-    close(fd);
+    if (cfg->light_source == LIGHT_ALS && !calibrate_pending) {
+        schedule_next(); // Camera not allowed; wait for the sensor
+    } else if (capture_start() < 0) {
+        capture_failed(errno == EBUSY);
+        schedule_next();
+    }
+}
+
+// Redoes only the work a config change calls for
+void apply_changes(unsigned changed) {
+    if (!changed || epfd < 0) return; // Nothing to redo before the loop is up
+    const Config *cfg = config_get();
+    log_msg("Config v%lu (changed 0x%x)", cfg->version, changed);
+
+    if (changed & CONFIG_RAMP) {
+        for (int i = 0; i < output_count; i++) ramp_configure(&outputs[i].ramp, cfg->ramp_ms, cfg->ramp_hz);
+    }
+    if (changed & CONFIG_DISPLAYS) {
+        outputs_close();
+        if (outputs_open() == 0) fprintf(stderr, "Warning: No usable display in %s\n", cfg->displays);
+        else if (last_percent >= 0.0) outputs_apply(last_percent); // New ones start where the others are
+    }
+    if (changed & CONFIG_EXPORT) {
+        last_export = 0;
+        export_stats();
+    }
+
+    if (changed & CONFIG_CURVE) curve_compile(&curve, cfg);
+
+    if (changed & (CONFIG_CAPTURE | CONFIG_MODE)) {
+        // Needs a fresh reading (or a camera release when going manual)
+        if (changed & CONFIG_CAPTURE) {
+            als_update();
+            capture_failures = 0; // Give a new camera a fresh start
+            capture_backoff = 0;
+            tracker_reset(&tracker); // Another sensor, another scale
+        }
+        schedule_sample(0);
+    } else {
+        if (changed & CONFIG_CURVE) {
+            // The last reading is still good; just map it again
+            if (cfg->mode == 1) apply_manual();
+            else if (tracker.primed) apply_auto(tracker.estimate);
+            else schedule_sample(0);
+        }
+        if ((changed & CONFIG_TIMING) && !capture.active) schedule_next();
+    }
+    publish_state();
+}
 
-    return (pixel_count == 0) ? 0 : (int)(total_y / pixel_count);
+void on_sample_timer(Watch *w, uint32_t events) {
+    if (timer_drain(w->fd)) run_cycle();
 }
 
+void on_idle_timer(Watch *w, uint32_t events) {
+    const Config *cfg = config_get();
+    if (!timer_drain(w->fd) || capture.active || !source_is_open(&camera)) return;
+
+    double idle_left = cfg->stream_idle - source_idle_seconds(&camera);
+    if (idle_left <= 0.0) source_close(&camera);
+    else timer_arm(idle_timer.fd, idle_left);
+}
+
+void on_signal(Watch *w, uint32_t events) {
+    struct signalfd_siginfo si;
+    while (read(w->fd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGHUP) {
+            if (verbose) printf("Reloading %s\n", g_config_path);
+            load_config(g_config_path);
+        } else if (si.ssi_signo == SIGUSR1) {
+            // From the system-sleep hook: about to suspend
+            suspending = 1;
+            panel_dark("suspending");
+        } else if (si.ssi_signo == SIGUSR2) {
+            // ...and back
+            suspending = 0;
+            asleep_ns = suspended_ns();
+            if (displays_lit()) panel_lit("woke from suspend");
+        } else {
+            running = 0;
+        }
+    }
+}
+
+Watch signal_watch = { .fd = -1, .on_event = on_signal };
+
 void print_usage(char *prog_name) {
     printf("Usage: %s [OPTIONS]\n", prog_name);
     printf("Options:\n");
     printf("  -c <path>      Path to config file (default: /etc/lumos.conf)\n");
-    printf("  -i <seconds>   Check interval (overrides config)\n");
+    printf("  -i <seconds>   Longest check interval (overrides config)\n");
+    printf("  -b <dir>       Backlight class or device directory (default: %s)\n", BACKLIGHT_CLASS);
+    printf("  -d <dir>       DRM class directory for display power (default: %s)\n", DRM_CLASS);
+    printf("  -r <dir>       Directory for lumos.sock and lumos.status (default: /run)\n");
     printf("  -v             Verbose mode (print logs)\n");
     printf("  -h             Show this help\n");
 }
@@ -366,84 +1601,141 @@ int main(int argc, char *argv[]) {
     load_config(config_path);
 
     optind = 1; 
-    while ((opt = getopt(argc, argv, "c:i:vh")) != -1) {
+    while ((opt = getopt(argc, argv, "c:i:b:d:r:vh")) != -1) {
         switch (opt) {
             case 'c': /* Already handled above */ break;
             case 'i': interval_override = atoi(optarg); break;
+            case 'b': backlight_class = optarg; break;
+            case 'd': drm_class = optarg; break;
+            case 'r':
+                // The socket path has to fit sun_path (108 bytes), or bind() would use a truncated one
+                if (strlen(optarg) + sizeof("/lumos.sock") > sizeof(((struct sockaddr_un *)0)->sun_path)) {
+                    fprintf(stderr, "Runtime directory path too long: %s\n", optarg);
+                    return 1;
+                }
+                snprintf(socket_path, sizeof(socket_path), "%s/lumos.sock", optarg);
+                snprintf(status_path, sizeof(status_path), "%s/lumos.status", optarg);
+                break;
             case 'v': verbose = 1; break;
             case 'h': print_usage(argv[0]); return 0;
             default: print_usage(argv[0]); return 1;
         }
     }
 
-    if (interval_override > 0) config.interval = interval_override;
-
-    if (!find_backlight_driver()) {
-        fprintf(stderr, "Error: No backlight driver found in /sys/class/backlight/\n");
-        return 1;
+    if (interval_override > 0) {
+        Config next = *config_get();
+        next.interval = interval_override;
+        config_commit(&next);
     }
-    
+    const Config *cfg = config_get();
+
+    curve_path_for(config_path, curve_path, sizeof(curve_path));
+    if (curve_load(&curve, curve_path) == 0 && verbose) printf("Curve: %s (%u samples)\n", curve_path, curve.samples);
+    curve_compile(&curve, cfg);
+    config_sibling(config_path, "state", state_path, sizeof(state_path));
+
     if (verbose) {
         printf("Lumos started.\n");
-        printf("Driver: %s\n", backlight_path);
         printf("Config: %s\n", config_path);
-        printf("Interval: %d seconds\n", config.interval);
-        printf("Range: %d%% - %d%%\n", config.min_brightness, config.max_brightness);
+        printf("Interval: %d-%d seconds\n", cfg->interval_min, cfg->interval);
+        printf("Range: %d%% - %d%%\n", cfg->min_brightness, cfg->max_brightness);
+        printf("Luma kernel: %s\n", luma_kernel_name());
     }
 
-    // Start IPC thread
-    pthread_t tid;
-    pthread_create(&tid, NULL, socket_thread, NULL);
-    pthread_detach(tid);
+    // Probe the camera once up front so the first sample doesn't pay for it
+    source_mode(cfg->camera_dev, 1);
 
-    while (1) {
-        if (config.mode == 1) {
-            // MANUAL MODE
-            int max_b = read_int("max_brightness");
-            int cur_b = read_int("brightness");
-            if (max_b > 0) {
-                 int target = (int)((config.manual_brightness / 100.0) * max_b);
-                 if (abs(cur_b - target) > (max_b * 0.01)) { // Tighter tolerance for manual
-                    if (verbose) printf("Manual: %d%%\n", config.manual_brightness);
-                    write_int("brightness", target);
-                 }
-            }
-        } else {
-            // AUTO MODE
-            int luma = capture_luma();
-            
-            if (luma >= 0) {
-                int max_b = read_int("max_brightness");
-                int cur_b = read_int("brightness");
-    
-                if (max_b > 0) {
-                    double percent = (double)luma / 180.0 * 100.0;                
-                    percent *= config.sensitivity;
-                    percent += config.brightness_offset;
-                    if (percent < config.min_brightness) percent = config.min_brightness;
-                    if (percent > config.max_brightness) percent = config.max_brightness;
-    
-                    int target = (int)((percent / 100.0) * max_b);
-    
-                    if (abs(cur_b - target) > (max_b * 0.05)) {
-                        log_msg("Ambient: %d -> Target: %d", luma, target);
-                        write_int("brightness", target);
-                    }
-                }
-            } else {
-                log_msg("Warning: Failed to capture from camera.");
-            }
-        }
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
 
-        // Wait for interval OR wake signal
-        struct timespec ts;
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_sec += config.interval;
-        
-        pthread_mutex_lock(&wake_mutex);
-        pthread_cond_timedwait(&wake_cond, &wake_mutex, &ts);
-        pthread_mutex_unlock(&wake_mutex);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    signal_watch.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    sample_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    idle_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    capture_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    persist_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    reload_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    power_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    apply_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    legacy_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd < 0 || signal_watch.fd < 0 || sample_timer.fd < 0 || idle_timer.fd < 0 || capture_timer.fd < 0 ||
+        persist_timer.fd < 0 || reload_timer.fd < 0 || power_timer.fd < 0 || apply_timer.fd < 0 ||
+        legacy_timer.fd < 0) {
+        perror("Event loop setup");
+        return 1;
     }
+    tracker_reset(&tracker);
+
+    watch_add(&signal_watch, EPOLLIN);
+    watch_add(&sample_timer, EPOLLIN);
+    watch_add(&idle_timer, EPOLLIN);
+    watch_add(&capture_timer, EPOLLIN);
+    watch_add(&persist_timer, EPOLLIN);
+    watch_add(&reload_timer, EPOLLIN);
+    watch_add(&power_timer, EPOLLIN);
+    watch_add(&apply_timer, EPOLLIN);
+    watch_add(&legacy_timer, EPOLLIN);
+    if (config_watch_init() < 0 && verbose) perror("Config file watch");
+    if (uevent_init() < 0 && verbose) perror("Uevent socket");
 
+    if (outputs_open() == 0) {
+        fprintf(stderr, "Error: No display found for '%s' (backlight class %s)\n", cfg->displays, backlight_class);
+        return 1;
+    }
+    als_update();
+
+    double saved_percent;
+    if (cfg->mode == 0 && load_state(&saved_percent) == 0) {
+        log_msg("Restoring %.0f%% from %s", saved_percent, state_path);
+        outputs_apply(saved_percent);
+        state_dirty = 0;
+    }
+
+    if (socket_init() < 0) fprintf(stderr, "Warning: IPC socket unavailable\n");
+
+    status_page = status_create(status_path);
+    if (!status_page) fprintf(stderr, "Warning: Status page %s unavailable\n", status_path);
+    publish_state();
+
+    // Clients can connect from here on; the first sample follows in the loop
+    systemd_notify("READY=1");
+    asleep_ns = suspended_ns();
+    if (!displays_lit()) panel_dark("displays off");
+    timer_arm(power_timer.fd, power_poll);
+    schedule_sample(0);
+
+    struct epoll_event events[16];
+    while (running) {
+        int n = epoll_wait(epfd, events, 16, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            Watch *w = events[i].data.ptr;
+            w->on_event(w, events[i].events);
+        }
+        clients_reap();
+    }
+
+    if (verbose) printf("Lumos shutting down.\n");
+    systemd_notify("STOPPING=1");
+    capture_end();
+    source_close(&camera); // Hands exposure control back to the driver
+    outputs_close();
+    als_close(&als);
+    if (persist_pending) save_config();
+    if (curve_pending) save_curve();
+    save_state(1);
+    if (listen_watch.fd >= 0 && !socket_inherited) unlink(socket_path);
+    status_destroy(status_page);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,447 @@
+/*
+ * Lumos: MJPEG luma from DC coefficients
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include "luma.h"
+
+/*
+ * The DC coefficient of each 8x8 block is eight times the block's mean
+ * (less 128), so the luma DC terms alone are an 8x-downsampled image,
+ * which is plenty for metering. Getting at them still means walking every
+ * Huffman code in the scan, but there is no dequantization beyond one
+ * multiply, no IDCT and no colour conversion. Baseline and extended
+ * Huffman frames only; anything else is rejected.
+ */
+
+#define HUFF_FAST 10 // Codes up to this long decode in one lookup
+
+typedef struct {
+    uint8_t fast_len[1 << HUFF_FAST]; // 0 = longer code, take the slow path
+    uint8_t fast_sym[1 << HUFF_FAST];
+    uint8_t fast_skip[1 << HUFF_FAST]; // AC: code and value bits together, 0 = slow path
+    uint8_t fast_step[1 << HUFF_FAST]; // AC: coefficients covered (64 for EOB)
+    int32_t maxcode[18];              // Largest code of each length, -1 if none
+    int32_t delta[17];                // Code to index into vals
+    uint8_t vals[256];
+    int defined;
+} Huff;
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint64_t acc;  // Next bits, MSB first
+    int n;         // Valid bits in acc
+    int pad;       // Zero bytes fed in after the scan data ran out
+    int marker;    // Reached a marker
+} Bits;
+
+typedef struct {
+    int id;
+    int h, v;      // Sampling factors
+    int tq;        // Quantization table
+    int td, ta;    // Huffman tables for this scan
+    int pred;      // DC predictor
+} Component;
+
+typedef struct {
+    Huff dc[4];
+    Huff ac[4];
+    uint16_t q0[4];  // DC quantizer of each table
+    Component comp[4];
+    int n_comp;
+    int width, height;
+    int hmax, vmax;
+    int restart;     // MCUs per restart interval, 0 if none
+} Jpeg;
+
+// ITU T.81 Annex K.3; UVC cameras leave the DHT out of every frame and
+// expect these
+static const uint8_t dc_luma_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t ac_luma_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const uint8_t ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+// (run, size) to coefficients covered and value bits, for skipping
+static int ac_step(int rs) {
+    if ((rs & 15) == 0) return rs == 0xF0 ? 16 : 64;
+    return (rs >> 4) + 1;
+}
+
+static int huff_build(Huff *h, const uint8_t bits[16], const uint8_t *vals) {
+    int total = 0;
+    for (int len = 0; len < 16; len++) total += bits[len];
+    if (total > 256) return -1;
+    h->defined = 0;
+    memcpy(h->vals, vals, total);
+    memset(h->fast_len, 0, sizeof(h->fast_len));
+    memset(h->fast_skip, 0, sizeof(h->fast_skip));
+
+    int32_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        h->delta[len] = k - code;
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++) {
+            if (code >= 1 << len) return -1; // Over-subscribed; checked before the fast table is indexed with it
+            if (len <= HUFF_FAST) {
+                int shift = HUFF_FAST - len;
+                for (int j = 0; j < 1 << shift; j++) {
+                    h->fast_len[(code << shift) | j] = len;
+                    h->fast_sym[(code << shift) | j] = vals[k];
+                    h->fast_skip[(code << shift) | j] = len + (vals[k] & 15);
+                    h->fast_step[(code << shift) | j] = ac_step(vals[k]);
+                }
+            }
+        }
+        h->maxcode[len] = bits[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    h->maxcode[17] = INT32_MAX;
+    h->defined = 1;
+    return 0;
+}
+
+static void bits_init(Bits *b, const unsigned char *p, const unsigned char *end) {
+    b->p = p;
+    b->end = end;
+    b->acc = 0;
+    b->n = 0;
+    b->pad = 0;
+    b->marker = 0;
+}
+
+// Undoes byte stuffing and stops at the next marker; zeros are fed in past it
+static void bits_fill(Bits *b) {
+    // Most of the time the next eight bytes hold no 0xFF and go in whole
+    if (!b->marker && b->end - b->p >= 8) {
+        uint64_t w;
+        memcpy(&w, b->p, 8);
+        w = be64toh(w);
+        uint64_t x = ~w;
+        if (!((x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull)) {
+            int take = (64 - b->n) >> 3;
+            int shift = 64 - b->n - take * 8;
+            b->acc |= (w >> b->n) >> shift << shift;
+            b->p += take;
+            b->n += take * 8;
+            return;
+        }
+    }
+    while (b->n <= 56) {
+        unsigned int c = 0;
+        int real = 0;
+        if (!b->marker && b->p < b->end) {
+            if (b->p[0] != 0xFF) {
+                c = *b->p++;
+                real = 1;
+            } else if (b->p + 1 < b->end && b->p[1] == 0x00) {
+                c = 0xFF;
+                b->p += 2;
+                real = 1;
+            } else {
+                b->marker = 1;
+            }
+        }
+        if (!real) b->pad++;
+        b->acc |= (uint64_t)c << (56 - b->n);
+        b->n += 8;
+    }
+}
+
+// Taken more bits than the scan had
+static int bits_overrun(const Bits *b) {
+    return b->pad * 8 > b->n;
+}
+
+// At most 16 bits; the caller makes sure they are there
+static unsigned int bits_take(Bits *b, int k) {
+    unsigned int v = b->acc >> (64 - k);
+    b->acc <<= k;
+    b->n -= k;
+    return v;
+}
+
+// Needs 16 bits in the accumulator
+static int huff_decode(Bits *b, const Huff *h) {
+    unsigned int peek = b->acc >> (64 - HUFF_FAST);
+    int len = h->fast_len[peek];
+    if (len) {
+        b->acc <<= len;
+        b->n -= len;
+        return h->fast_sym[peek];
+    }
+    for (len = HUFF_FAST + 1; len <= 16; len++) {
+        int32_t code = b->acc >> (64 - len);
+        if (code <= h->maxcode[len]) {
+            b->acc <<= len;
+            b->n -= len;
+            return h->vals[code + h->delta[len]];
+        }
+    }
+    return -1;
+}
+
+static int extend(unsigned int v, int s) {
+    return v < 1u << (s - 1) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+// One block: returns the DC difference, walks past the AC codes. Only the
+// size of each AC value matters, so its bits are skipped unread.
+static int decode_block(Bits *b, const Huff *dc, const Huff *ac, int *diff) {
+    if (b->n < 32) bits_fill(b);
+    int s = huff_decode(b, dc);
+    if (s < 0 || s > 11) return -1;
+    *diff = s ? extend(bits_take(b, s), s) : 0;
+
+    for (int k = 1; k < 64;) {
+        if (b->n < 32) bits_fill(b);
+        unsigned int peek = b->acc >> (64 - HUFF_FAST);
+        int skip = ac->fast_skip[peek];
+        if (skip) {
+            b->acc <<= skip;
+            b->n -= skip;
+            k += ac->fast_step[peek];
+            continue;
+        }
+        int rs = huff_decode(b, ac);
+        if (rs < 0) return -1;
+        b->acc <<= rs & 15;
+        b->n -= rs & 15;
+        k += ac_step(rs);
+    }
+    return 0;
+}
+
+static unsigned int segment_length(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static int parse_dqt(Jpeg *j, const unsigned char *p, unsigned int len) {
+    while (len > 0) {
+        int pq = p[0] >> 4, tq = p[0] & 15;
+        unsigned int size = 1 + (pq ? 128 : 64);
+        if (tq > 3 || len < size) return -1;
+        j->q0[tq] = pq ? (p[1] << 8) | p[2] : p[1];
+        p += size;
+        len -= size;
+    }
+    return 0;
+}
+
+static int parse_dht(Jpeg *j, const unsigned char *p, unsigned int len) {
+    while (len > 17) {
+        int tc = p[0] >> 4, th = p[0] & 15;
+        if (tc > 1 || th > 3) return -1;
+        unsigned int total = 0;
+        for (int i = 0; i < 16; i++) total += p[1 + i];
+        if (len < 17 + total) return -1;
+        if (huff_build(tc ? &j->ac[th] : &j->dc[th], p + 1, p + 17) < 0) return -1;
+        p += 17 + total;
+        len -= 17 + total;
+    }
+    return len == 0 ? 0 : -1;
+}
+
+static int parse_sof(Jpeg *j, const unsigned char *p, unsigned int len) {
+    if (len < 6 || p[0] != 8) return -1;
+    j->height = segment_length(p + 1);
+    j->width = segment_length(p + 3);
+    j->n_comp = p[5];
+    if (j->width == 0 || j->height == 0 || j->n_comp < 1 || j->n_comp > 4 || len < 6u + j->n_comp * 3) return -1;
+
+    j->hmax = j->vmax = 1;
+    for (int i = 0; i < j->n_comp; i++) {
+        Component *c = &j->comp[i];
+        c->id = p[6 + i * 3];
+        c->h = p[7 + i * 3] >> 4;
+        c->v = p[7 + i * 3] & 15;
+        c->tq = p[8 + i * 3] & 3;
+        if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4) return -1;
+        if (c->h > j->hmax) j->hmax = c->h;
+        if (c->v > j->vmax) j->vmax = c->v;
+    }
+    return 0;
+}
+
+static void add_block(LumaStats *st, int dc, unsigned int q0) {
+    // Block mean = DC * q0 / 8 + 128
+    int y = (dc * (int)q0 + 4 * (dc >= 0 ? 1 : -1)) / 8 + 128;
+    if (y < 0) y = 0;
+    if (y > 255) y = 255;
+    st->hist[y]++;
+    st->count++;
+    st->mean += y;
+    if ((unsigned int)y < st->min) st->min = y;
+    if ((unsigned int)y > st->max) st->max = y;
+}
+
+static int decode_scan(Jpeg *j, const unsigned char *p, unsigned int len, const unsigned char *end, LumaStats *st) {
+    int ns = p[0];
+    if (ns < 1 || ns > j->n_comp || len < 4u + ns * 2) return -1;
+
+    Component *scan[4];
+    Component *luma = &j->comp[0];
+    int has_luma = 0;
+    for (int i = 0; i < ns; i++) {
+        int id = p[1 + i * 2];
+        scan[i] = NULL;
+        for (int k = 0; k < j->n_comp; k++) {
+            if (j->comp[k].id == id) scan[i] = &j->comp[k];
+        }
+        if (!scan[i]) return -1;
+        scan[i]->td = p[2 + i * 2] >> 4;
+        scan[i]->ta = p[2 + i * 2] & 15;
+        if (scan[i]->td > 3 || scan[i]->ta > 3) return -1;
+        if (!j->dc[scan[i]->td].defined || !j->ac[scan[i]->ta].defined) return -1;
+        scan[i]->pred = 0;
+        if (scan[i] == luma) has_luma = 1;
+    }
+    if (!has_luma) return 1; // Chroma scan of a non-interleaved frame; keep looking
+    // Full spectral range only: a progressive frame has no DC-only luma scan to stop after
+    const unsigned char *sp = p + 1 + ns * 2;
+    if (sp[0] != 0 || sp[1] != 63 || sp[2] != 0) return -1;
+
+    // Luma blocks that hold picture, not padding
+    int luma_cols = ((j->width * luma->h + j->hmax - 1) / j->hmax + 7) / 8;
+    int luma_rows = ((j->height * luma->v + j->vmax - 1) / j->vmax + 7) / 8;
+
+    int mcu_cols, mcu_rows;
+    if (ns == 1) {
+        mcu_cols = luma_cols;
+        mcu_rows = luma_rows;
+    } else {
+        mcu_cols = (j->width + 8 * j->hmax - 1) / (8 * j->hmax);
+        mcu_rows = (j->height + 8 * j->vmax - 1) / (8 * j->vmax);
+    }
+
+    Bits b;
+    bits_init(&b, p + len, end);
+    int todo = j->restart;
+    for (int my = 0; my < mcu_rows; my++) {
+        for (int mx = 0; mx < mcu_cols; mx++) {
+            if (j->restart && todo-- == 0) {
+                // Byte-aligned RSTn, then every predictor starts over
+                if (bits_overrun(&b) || b.p + 1 >= end || b.p[0] != 0xFF || (b.p[1] & 0xF8) != 0xD0) return -1;
+                bits_init(&b, b.p + 2, end);
+                for (int i = 0; i < ns; i++) scan[i]->pred = 0;
+                todo = j->restart - 1;
+            }
+            for (int i = 0; i < ns; i++) {
+                Component *c = scan[i];
+                int bh = ns == 1 ? 1 : c->h, bv = ns == 1 ? 1 : c->v;
+                for (int by = 0; by < bv; by++) {
+                    for (int bx = 0; bx < bh; bx++) {
+                        int diff;
+                        if (decode_block(&b, &j->dc[c->td], &j->ac[c->ta], &diff) < 0) return -1;
+                        c->pred += diff;
+                        if (c != luma) continue;
+                        if (ns > 1 && (mx * bh + bx >= luma_cols || my * bv + by >= luma_rows)) continue;
+                        add_block(st, c->pred, j->q0[c->tq]);
+                    }
+                }
+            }
+        }
+    }
+    return bits_overrun(&b) ? -1 : 0;
+}
+
+int luma_stats_mjpeg(const unsigned char *data, size_t bytes, LumaStats *st) {
+    memset(st, 0, sizeof(*st));
+    st->min = 255;
+
+    Jpeg j;
+    memset(&j, 0, sizeof(j));
+    const unsigned char *p = data, *end = data + bytes;
+    if (bytes < 4 || p[0] != 0xFF || p[1] != 0xD8) return -1;
+    p += 2;
+
+    int have_sof = 0;
+    while (p + 4 <= end) {
+        if (p[0] != 0xFF) return -1;
+        int marker = p[1];
+        if (marker == 0xFF) {
+            p++; // Fill byte
+            continue;
+        }
+        if (marker == 0xD9) break; // EOI before any luma scan
+        unsigned int len = segment_length(p + 2);
+        if (len < 2 || p + 2 + len > end) return -1;
+        const unsigned char *seg = p + 4;
+        len -= 2;
+
+        int rc = 0;
+        switch (marker) {
+            case 0xDB: rc = parse_dqt(&j, seg, len); break;
+            case 0xC4: rc = parse_dht(&j, seg, len); break;
+            case 0xDD:
+                if (len < 2) return -1;
+                j.restart = segment_length(seg);
+                break;
+            case 0xC0:
+            case 0xC1:
+                rc = parse_sof(&j, seg, len);
+                have_sof = rc == 0;
+                break;
+            case 0xDA:
+                if (!have_sof) return -1;
+                // Motion JPEG leaves the tables out; the standard ones are meant
+                if (!j.dc[0].defined) huff_build(&j.dc[0], dc_luma_bits, dc_vals);
+                if (!j.dc[1].defined) huff_build(&j.dc[1], dc_chroma_bits, dc_vals);
+                if (!j.ac[0].defined) huff_build(&j.ac[0], ac_luma_bits, ac_luma_vals);
+                if (!j.ac[1].defined) huff_build(&j.ac[1], ac_chroma_bits, ac_chroma_vals);
+                if (j.q0[j.comp[0].tq] == 0) return -1;
+                rc = decode_scan(&j, seg, len, end, st);
+                if (rc == 0) {
+                    st->mean = st->count ? st->mean / st->count : 0.0;
+                    if (!st->count) st->min = 0;
+                    return st->count ? 0 : -1;
+                }
+                if (rc < 0) return -1;
+                // A chroma-only scan: skip its entropy-coded data to the next marker
+                p = seg + len;
+                while (p + 1 < end && !(p[0] == 0xFF && p[1] != 0x00 && (p[1] & 0xF8) != 0xD0)) p++;
+                continue;
+            default:
+                // Progressive, lossless and arithmetic-coded frames
+                if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) return -1;
+                break;
+        }
+        if (rc < 0) return -1;
+        p = seg + len;
+    }
+    return -1;
+}
@@ -0,0 +1,121 @@
+/*
+ * Lumos: smooth brightness transitions
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "ramp.h"
+
+#define RAMP_GAMMA 2.2
+
+static double to_perceptual(const Display *d, int level) {
+    if (level <= 0) return 0.0;
+    return pow((double)level / d->max, 1.0 / RAMP_GAMMA);
+}
+
+static int to_level(const Display *d, double p) {
+    if (p < 0.0) p = 0.0;
+    if (p > 1.0) p = 1.0;
+    return (int)lround(pow(p, RAMP_GAMMA) * d->max);
+}
+
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static void arm(Ramp *r, int on) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (on) {
+        long period_ns = 1000000000L / r->rate_hz;
+        its.it_interval.tv_sec = period_ns / 1000000000L;
+        its.it_interval.tv_nsec = period_ns % 1000000000L;
+        its.it_value = its.it_interval;
+    }
+    timerfd_settime(r->timer_fd, 0, &its, NULL);
+}
+
+int ramp_init(Ramp *r, Display *d) {
+    memset(r, 0, sizeof(*r));
+    r->d = d;
+    r->duration_ms = 300;
+    r->rate_hz = 60;
+    r->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return r->timer_fd < 0 ? -1 : 0;
+}
+
+void ramp_close(Ramp *r) {
+    if (r->timer_fd >= 0) close(r->timer_fd);
+    r->timer_fd = -1;
+    r->active = 0;
+}
+
+void ramp_configure(Ramp *r, int duration_ms, int rate_hz) {
+    r->duration_ms = duration_ms < 0 ? 0 : duration_ms;
+    r->rate_hz = rate_hz < 1 ? 1 : (rate_hz > 1000 ? 1000 : rate_hz);
+}
+
+// Position on the current fade
+static double position(Ramp *r, int *done) {
+    double t = r->duration_ms > 0 ? elapsed_ms(&r->start) / r->duration_ms : 1.0;
+    *done = t >= 1.0;
+    if (*done) return r->to;
+    return r->from + (r->to - r->from) * t;
+}
+
+void ramp_set_target(Ramp *r, int level) {
+    if (level < 0) level = 0;
+    if (level > r->d->max) level = r->d->max;
+
+    if (r->active && level == r->target) return;
+
+    int done;
+    double from = r->active ? position(r, &done) : to_perceptual(r->d, display_current(r->d));
+
+    r->target = level;
+    if (r->duration_ms == 0 || level == display_current(r->d)) {
+        r->active = 0;
+        arm(r, 0);
+        display_write(r->d, level);
+        return;
+    }
+
+    r->from = from;
+    r->to = to_perceptual(r->d, level);
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+    if (!r->active) arm(r, 1);
+    r->active = 1;
+}
+
+int ramp_destination(Ramp *r) {
+    return r->active ? r->target : display_current(r->d);
+}
+
+void ramp_tick(Ramp *r) {
+    uint64_t expirations;
+    if (read(r->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+
+    if (r->active) {
+        int done;
+        double p = position(r, &done);
+        // Snap to the exact target at the end; gamma rounding may not land on it
+        int level = done ? r->target : to_level(r->d, p);
+        display_write(r->d, level); // No-op unless the level changes
+        if (done) {
+            r->active = 0;
+            arm(r, 0);
+        }
+    }
+}
+
+int ramp_fd(const Ramp *r) {
+    return r->timer_fd;
+}
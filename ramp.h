@@ -0,0 +1,41 @@
+/*
+ * Lumos: smooth brightness transitions
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_RAMP_H
+#define LUMOS_RAMP_H
+
+#include <time.h>
+
+#include "display.h"
+
+// Fades a display toward a target in steps that look even to the eye
+// (interpolated in gamma space), paced by a CLOCK_MONOTONIC timerfd.
+typedef struct {
+    Display *d;
+    int timer_fd;
+    int active;
+    int duration_ms;
+    int rate_hz;
+    int target;        // Hardware level the ramp ends on
+    double from;       // Perceptual position (0..1) at start
+    double to;
+    struct timespec start;
+} Ramp;
+
+int ramp_init(Ramp *r, Display *d);
+void ramp_close(Ramp *r);
+void ramp_configure(Ramp *r, int duration_ms, int rate_hz);
+
+// Starts a fade, or bends a running one toward the new target from wherever it is now
+void ramp_set_target(Ramp *r, int level);
+// Where the display is heading (the current level when idle)
+int ramp_destination(Ramp *r);
+
+// Call when ramp_fd() is readable
+void ramp_tick(Ramp *r);
+int ramp_fd(const Ramp *r);
+
+#endif
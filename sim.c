@@ -0,0 +1,351 @@
+/*
+ * Lumos: control loop simulator
+ * Author: Anıl Aras
+ * License: MIT
+ *
+ * Replays an ambient light trace through the daemon's own decision code
+ * (tracker, curve, hysteresis) on a virtual clock, so a week of light takes
+ * well under a second. Reports the work the daemon would have done (samples,
+ * camera starts, backlight writes) and how closely the backlight followed a
+ * reference mapping of the true light. One JSON document on stdout.
+ *
+ * Traces are either a synth: program (see source_synth.c) or a text file of
+ * "<seconds> <luma>" lines, linearly interpolated; both loop when the run is
+ * longer than they are.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "config.h"
+#include "control.h"
+#include "curve.h"
+#include "source.h"
+
+#define SIM_MAX_LEVEL 255       // Backlight scale; many laptop panels use this
+#define SIM_STEP 1.0            // Seconds between checks of the displayed level against the reference
+#define SIM_NOISE 1.0           // Sensor noise, standard deviation in luma
+#define SIM_SEED 1
+#define SIM_FAR 10.0            // Percent off the reference that counts as visibly wrong
+
+int verbose = 0;
+
+typedef struct {
+    SynthProgram program; // Used when n == 0
+    double *time;
+    double *luma;
+    size_t n;
+    double total;
+} Trace;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Times are made relative to the first line, so epoch stamps work as well
+static int trace_load(Trace *tr, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    size_t cap = 0;
+    double t0 = 0.0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        double t, luma;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        for (char *c = p; *c; c++) {
+            if (*c == ',') *c = ' ';
+        }
+        if (sscanf(p, "%lf %lf", &t, &luma) != 2 || luma < 0.0 || luma > 255.0) {
+            fprintf(stderr, "Bad trace line in %s: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+        if (tr->n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            double *nt = realloc(tr->time, cap * sizeof(double));
+            double *nl = nt ? realloc(tr->luma, cap * sizeof(double)) : NULL;
+            if (nt) tr->time = nt;
+            if (!nl) {
+                fclose(f);
+                return -1;
+            }
+            tr->luma = nl;
+        }
+        if (tr->n == 0) t0 = t;
+        if (tr->n && t - t0 < tr->time[tr->n - 1]) {
+            fprintf(stderr, "Trace %s goes back in time: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+        tr->time[tr->n] = t - t0;
+        tr->luma[tr->n] = luma;
+        tr->n++;
+    }
+    fclose(f);
+    if (tr->n < 2) {
+        fprintf(stderr, "Trace %s needs at least two points\n", path);
+        return -1;
+    }
+    tr->total = tr->time[tr->n - 1];
+    if (tr->total <= 0.0) {
+        fprintf(stderr, "Trace %s covers no time\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static double trace_at(const Trace *tr, double t) {
+    if (tr->n == 0) return synth_level(&tr->program, t);
+
+    t = fmod(t, tr->total);
+    size_t lo = 0, hi = tr->n - 1;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (tr->time[mid] <= t) lo = mid;
+        else hi = mid;
+    }
+    double span = tr->time[hi] - tr->time[lo];
+    if (span <= 0.0) return tr->luma[hi];
+    return tr->luma[lo] + (tr->luma[hi] - tr->luma[lo]) * (t - tr->time[lo]) / span;
+}
+
+// Box-Muller; the fixed seed makes runs repeatable, which CI needs
+static double gaussian(unsigned int *seed) {
+    double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+// "604800", "90m", "36h", "7d"
+static double parse_duration(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0.0) return -1.0;
+    if (*end == 'm') v *= 60.0;
+    else if (*end == 'h') v *= 3600.0;
+    else if (*end == 'd') v *= 86400.0;
+    else if (*end && *end != 's') return -1.0;
+    return v;
+}
+
+static int load_config(const char *path, Config *cfg) {
+    config_defaults(cfg);
+    if (path && config_load(path, cfg) < 0) {
+        fprintf(stderr, "Cannot read config %s\n", path);
+        return -1;
+    }
+    if (config_check(cfg) < 0) {
+        fprintf(stderr, "Invalid brightness range in %s\n", path ? path : "defaults");
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    double seconds;
+    unsigned long samples;
+    unsigned long activations; // Camera starts; an idle stream stays open for stream_idle
+    unsigned long adjustments; // Times the loop decided to move
+    unsigned long writes;      // Backlight writes, as the ramp would issue them
+    double abs_error;          // Integrated |displayed - reference|, percent * seconds
+    double sq_error;
+    double max_error;
+    double far_seconds;        // Time spent more than SIM_FAR off
+} SimResult;
+
+static void simulate(const Config *cfg, const Curve *curve, const Config *ref_cfg, const Curve *ref_curve,
+                     const Trace *tr, double duration, double noise, unsigned int seed, SimResult *r) {
+    Tracker tracker;
+    tracker_reset(&tracker);
+    memset(r, 0, sizeof(*r));
+    r->seconds = duration;
+
+    int ramp_steps = cfg->ramp_ms > 0 ? cfg->ramp_ms * cfg->ramp_hz / 1000 : 1;
+    if (ramp_steps < 1) ramp_steps = 1;
+
+    int level = -1; // Nothing written yet
+    double last_sample = -1.0;
+    double t = 0.0;
+    while (t < duration) {
+        // A sample, as run_cycle() and process_reading() take it
+        if (last_sample < 0.0 || cfg->stream_idle <= 0 || t - last_sample > cfg->stream_idle) r->activations++;
+        last_sample = t;
+        r->samples++;
+
+        double luma = trace_at(tr, t) + noise * gaussian(&seed);
+        if (luma < 0.0) luma = 0.0;
+        if (luma > 255.0) luma = 255.0;
+        tracker_update(&tracker, cfg, luma, t);
+
+        // ...and the decision apply_auto() makes
+        double percent = control_auto_percent(cfg, curve, tracker.estimate);
+        int target = control_level(percent, SIM_MAX_LEVEL);
+        if (level < 0 || control_should_move(cfg, level, target, SIM_MAX_LEVEL)) {
+            int delta = level < 0 ? 1 : abs(target - level);
+            r->adjustments++;
+            r->writes += delta < ramp_steps ? delta : ramp_steps;
+            level = target;
+        }
+
+        double next = t + tracker_interval(&tracker, cfg);
+        if (next > duration) next = duration;
+
+        // Until the next sample the backlight holds still while the light may not
+        double shown = level * 100.0 / SIM_MAX_LEVEL;
+        for (double u = t; u < next; u += SIM_STEP) {
+            double dt = next - u < SIM_STEP ? next - u : SIM_STEP;
+            double ref = control_auto_percent(ref_cfg, ref_curve, trace_at(tr, u));
+            double err = fabs(shown - ref);
+            r->abs_error += err * dt;
+            r->sq_error += err * err * dt;
+            if (err > r->max_error) r->max_error = err;
+            if (err > SIM_FAR) r->far_seconds += dt;
+        }
+        t = next;
+    }
+}
+
+// Paths and synth programs can hold quotes, backslashes and control characters
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c == '\n') fputs("\\n", stdout);
+        else if (c == '\t') fputs("\\t", stdout);
+        else if (c < 0x20 || c == 0x7F) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] <trace file | synth:PROGRAM>\n", prog);
+    printf("Options:\n");
+    printf("  -c <path>      Config to simulate (default: built-in defaults)\n");
+    printf("  -l <path>      Learned curve to start from (lumos.curve)\n");
+    printf("  -r <path>      Config whose mapping is the reference (default: the simulated one, untrained)\n");
+    printf("  -D <duration>  Length of the run, e.g. 7d or 36h (default: one pass of the trace)\n");
+    printf("  -n <luma>      Sensor noise, standard deviation (default: %.1f)\n", SIM_NOISE);
+    printf("  -s <seed>      Noise seed (default: %d)\n", SIM_SEED);
+    printf("  -E <percent>   Fail if the mean error exceeds this\n");
+    printf("  -W <writes>    Fail if backlight writes per day exceed this\n");
+    printf("  -A <starts>    Fail if camera starts per day exceed this\n");
+    printf("  -h             Show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *config_path = NULL, *curve_path = NULL, *ref_path = NULL;
+    double duration = 0.0, noise = SIM_NOISE;
+    double max_error = -1.0, max_writes = -1.0, max_starts = -1.0;
+    unsigned int seed = SIM_SEED;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:l:r:D:n:s:E:W:A:h")) != -1) {
+        switch (opt) {
+            case 'c': config_path = optarg; break;
+            case 'l': curve_path = optarg; break;
+            case 'r': ref_path = optarg; break;
+            case 'D':
+                duration = parse_duration(optarg);
+                if (duration <= 0.0) {
+                    fprintf(stderr, "Bad duration: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n': noise = atof(optarg); break;
+            case 's': seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'E': max_error = atof(optarg); break;
+            case 'W': max_writes = atof(optarg); break;
+            case 'A': max_starts = atof(optarg); break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char *source = argv[optind];
+
+    Trace tr;
+    memset(&tr, 0, sizeof(tr));
+    if (strncmp(source, "synth:", 6) == 0) {
+        if (synth_parse(source + 6, &tr.program) < 0) {
+            fprintf(stderr, "Bad synth program: %s\n", source);
+            return 1;
+        }
+        tr.total = tr.program.total;
+    } else if (trace_load(&tr, source) < 0) {
+        return 1;
+    }
+    if (duration <= 0.0) duration = tr.total;
+
+    Config cfg, ref_cfg;
+    if (load_config(config_path, &cfg) < 0 || load_config(ref_path ? ref_path : config_path, &ref_cfg) < 0) return 1;
+    cfg.mode = 0; // The simulator only follows the light
+
+    Curve curve, ref_curve;
+    curve_reset(&curve);
+    if (curve_path && curve_load(&curve, curve_path) < 0) {
+        fprintf(stderr, "Cannot read curve %s\n", curve_path);
+        return 1;
+    }
+    curve_compile(&curve, &cfg);
+    curve_reset(&ref_curve);
+    curve_compile(&ref_curve, &ref_cfg);
+
+    SimResult r;
+    double start = now_s();
+    simulate(&cfg, &curve, &ref_cfg, &ref_curve, &tr, duration, noise, seed, &r);
+    double elapsed = now_s() - start;
+
+    double days = r.seconds / 86400.0;
+    double mean = r.abs_error / r.seconds;
+    printf("{\n  \"version\": 1,\n");
+    printf("  \"trace\": ");
+    print_json_string(source);
+    printf(",\n");
+    printf("  \"simulated_seconds\": %.0f,\n", r.seconds);
+    printf("  \"samples\": %lu,\n", r.samples);
+    printf("  \"camera_starts\": %lu,\n", r.activations);
+    printf("  \"camera_starts_per_day\": %.1f,\n", r.activations / days);
+    printf("  \"adjustments\": %lu,\n", r.adjustments);
+    printf("  \"writes\": %lu,\n", r.writes);
+    printf("  \"writes_per_day\": %.1f,\n", r.writes / days);
+    printf("  \"mean_error\": %.2f,\n", mean);
+    printf("  \"rms_error\": %.2f,\n", sqrt(r.sq_error / r.seconds));
+    printf("  \"max_error\": %.2f,\n", r.max_error);
+    printf("  \"far_fraction\": %.4f,\n", r.far_seconds / r.seconds);
+    printf("  \"wall_seconds\": %.3f,\n", elapsed);
+    printf("  \"speedup\": %.0f\n}\n", elapsed > 0.0 ? r.seconds / elapsed : 0.0);
+
+    int rc = 0;
+    if (max_error >= 0.0 && mean > max_error) {
+        fprintf(stderr, "Mean error %.2f%% exceeds %.2f%%\n", mean, max_error);
+        rc = 1;
+    }
+    if (max_writes >= 0.0 && r.writes / days > max_writes) {
+        fprintf(stderr, "%.1f writes per day exceeds %.1f\n", r.writes / days, max_writes);
+        rc = 1;
+    }
+    if (max_starts >= 0.0 && r.activations / days > max_starts) {
+        fprintf(stderr, "%.1f camera starts per day exceeds %.1f\n", r.activations / days, max_starts);
+        rc = 1;
+    }
+    free(tr.time);
+    free(tr.luma);
+    return rc;
+}
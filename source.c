@@ -0,0 +1,175 @@
+/*
+ * Lumos: pluggable frame sources
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "source.h"
+
+extern int verbose;
+
+static const FrameSourceOps *backends[] = { &file_source, &synth_source, &v4l2_source, NULL };
+
+static const FrameSourceOps *backend_for(const char *spec, const char **arg) {
+    for (int i = 0; backends[i]; i++) {
+        size_t n = strlen(backends[i]->prefix);
+        if (strncmp(spec, backends[i]->prefix, n) == 0) {
+            *arg = spec + n;
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+void source_init(FrameSource *src) {
+    memset(src, 0, sizeof(*src));
+    src->fd = -1;
+}
+
+const CameraMode *source_mode(const char *spec, int probe) {
+    const char *arg;
+    const FrameSourceOps *ops = backend_for(spec, &arg);
+    return ops ? ops->mode(arg, probe) : NULL;
+}
+
+int source_open(FrameSource *src, const char *spec) {
+    source_init(src);
+
+    const char *arg;
+    const FrameSourceOps *ops = backend_for(spec, &arg);
+    const CameraMode *mode = ops ? ops->mode(arg, 1) : NULL;
+    if (!mode) {
+        if (verbose) fprintf(stderr, "No usable capture format on %s\n", spec);
+        return -1;
+    }
+
+    snprintf(src->spec, sizeof(src->spec), "%s", spec);
+    src->mode = *mode;
+    if (ops->open(src, arg, mode) < 0) {
+        source_init(src);
+        return -1;
+    }
+    src->ops = ops;
+    source_touch(src);
+    return 0;
+}
+
+void source_close(FrameSource *src) {
+    if (!src->ops) return;
+    src->ops->close(src);
+    source_init(src);
+}
+
+int source_is_open(const FrameSource *src) {
+    return src->ops != NULL;
+}
+
+void source_flush(FrameSource *src) {
+    src->ops->flush(src);
+}
+
+int source_dequeue(FrameSource *src, CameraFrame *frame) {
+    return src->ops->dequeue(src, frame);
+}
+
+void source_requeue(FrameSource *src, const CameraFrame *frame) {
+    src->ops->requeue(src, frame);
+}
+
+int source_exposure_lock(FrameSource *src, long start) {
+    return src->ops && src->ops->exposure_lock ? src->ops->exposure_lock(src, start) : -1;
+}
+
+int source_exposure_set(FrameSource *src, long value) {
+    return src->ops && src->ops->exposure_set ? src->ops->exposure_set(src, value) : -1;
+}
+
+void source_exposure_unlock(FrameSource *src) {
+    if (src->ops && src->ops->exposure_unlock) src->ops->exposure_unlock(src);
+}
+
+const CameraExposure *source_exposure(FrameSource *src) {
+    static const CameraExposure none;
+    return src->ops && src->ops->exposure ? src->ops->exposure(src) : &none;
+}
+
+void source_touch(FrameSource *src) {
+    clock_gettime(CLOCK_MONOTONIC, &src->last_used);
+}
+
+double source_idle_seconds(const FrameSource *src) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - src->last_used.tv_sec) + (now.tv_nsec - src->last_used.tv_nsec) / 1e9;
+}
+
+// V4L2 webcam: a thin wrapper over CameraSession
+
+static const CameraMode *v4l2_mode(const char *dev, int probe) {
+    return probe ? camera_mode_lookup(dev) : camera_mode_cached(dev);
+}
+
+static int v4l2_open(FrameSource *src, const char *dev, const CameraMode *mode) {
+    CameraSession *cam = malloc(sizeof(*cam));
+    if (!cam) return -1;
+    camera_init(cam);
+    if (camera_open(cam, dev, mode) < 0) {
+        free(cam);
+        return -1;
+    }
+    src->priv = cam;
+    src->fd = cam->fd;
+    src->mode = cam->mode;
+    return 0;
+}
+
+static void v4l2_close(FrameSource *src) {
+    camera_close(src->priv);
+    free(src->priv);
+}
+
+static int v4l2_dequeue(FrameSource *src, CameraFrame *frame) {
+    return camera_dequeue(src->priv, frame);
+}
+
+static void v4l2_requeue(FrameSource *src, const CameraFrame *frame) {
+    camera_requeue(src->priv, frame);
+}
+
+static void v4l2_flush(FrameSource *src) {
+    camera_flush(src->priv);
+}
+
+static int v4l2_exposure_lock(FrameSource *src, long start) {
+    return camera_exposure_lock(src->priv, start);
+}
+
+static int v4l2_exposure_set(FrameSource *src, long value) {
+    return camera_exposure_set(src->priv, value);
+}
+
+static void v4l2_exposure_unlock(FrameSource *src) {
+    camera_exposure_unlock(src->priv);
+}
+
+static CameraExposure *v4l2_exposure(FrameSource *src) {
+    return &((CameraSession *)src->priv)->exposure;
+}
+
+const FrameSourceOps v4l2_source = {
+    .prefix = "",
+    .mode = v4l2_mode,
+    .open = v4l2_open,
+    .close = v4l2_close,
+    .dequeue = v4l2_dequeue,
+    .requeue = v4l2_requeue,
+    .flush = v4l2_flush,
+    .exposure_lock = v4l2_exposure_lock,
+    .exposure_set = v4l2_exposure_set,
+    .exposure_unlock = v4l2_exposure_unlock,
+    .exposure = v4l2_exposure
+};
@@ -0,0 +1,92 @@
+/*
+ * Lumos: pluggable frame sources
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_SOURCE_H
+#define LUMOS_SOURCE_H
+
+#include <time.h>
+
+#include "camera.h"
+
+// Where frames come from. camera_dev selects the backend by prefix:
+//   /dev/videoN                  V4L2 webcam
+//   file:WxH[@FPS]:PATH          raw YUYV frames from a file (looped) or FIFO
+//   synth:LEVEL[-LEVEL]/SECS,... generated frames following a light program
+typedef struct FrameSource FrameSource;
+
+typedef struct {
+    const char *prefix; // "" matches anything
+    // Mode frames will arrive in; probe=0 must not touch hardware. NULL if unusable.
+    const CameraMode *(*mode)(const char *arg, int probe);
+    int (*open)(FrameSource *src, const char *arg, const CameraMode *mode);
+    void (*close)(FrameSource *src);
+    // 1 = frame, 0 = none yet, -1 = error; frames go back via requeue
+    int (*dequeue)(FrameSource *src, CameraFrame *frame);
+    void (*requeue)(FrameSource *src, const CameraFrame *frame);
+    void (*flush)(FrameSource *src);
+    // Manual exposure; NULL for sources without one
+    int (*exposure_lock)(FrameSource *src, long start);
+    int (*exposure_set)(FrameSource *src, long value);
+    void (*exposure_unlock)(FrameSource *src);
+    CameraExposure *(*exposure)(FrameSource *src);
+} FrameSourceOps;
+
+struct FrameSource {
+    const FrameSourceOps *ops; // NULL while closed
+    char spec[64];
+    int fd;                    // Readable (EPOLLIN) when a frame may be ready
+    CameraMode mode;
+    struct timespec last_used; // CLOCK_MONOTONIC
+    void *priv;
+};
+
+extern const FrameSourceOps v4l2_source;
+extern const FrameSourceOps file_source;
+extern const FrameSourceOps synth_source;
+
+void source_init(FrameSource *src);
+// Cached/parsed capture mode for a spec (see FrameSourceOps.mode)
+const CameraMode *source_mode(const char *spec, int probe);
+
+int source_open(FrameSource *src, const char *spec);
+void source_close(FrameSource *src);
+int source_is_open(const FrameSource *src);
+
+void source_flush(FrameSource *src);
+int source_dequeue(FrameSource *src, CameraFrame *frame);
+void source_requeue(FrameSource *src, const CameraFrame *frame);
+
+// -1 if the source has no manual exposure
+int source_exposure_lock(FrameSource *src, long start);
+int source_exposure_set(FrameSource *src, long value);
+void source_exposure_unlock(FrameSource *src);
+// Never NULL; all zero for sources without manual exposure
+const CameraExposure *source_exposure(FrameSource *src);
+
+void source_touch(FrameSource *src);
+double source_idle_seconds(const FrameSource *src);
+
+// A synth: light program, also replayed by lumos-sim on its own clock
+#define SYNTH_MAX_SEGMENTS 32
+
+typedef struct {
+    double from;
+    double to;
+    double seconds;
+} SynthSegment;
+
+typedef struct {
+    SynthSegment segments[SYNTH_MAX_SEGMENTS];
+    int n_segments;
+    double total;     // Seconds per loop
+} SynthProgram;
+
+// The part after "synth:"; -1 if malformed
+int synth_parse(const char *arg, SynthProgram *p);
+// Level at t seconds into the program, looping
+double synth_level(const SynthProgram *p, double t);
+
+#endif
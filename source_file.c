@@ -0,0 +1,204 @@
+/*
+ * Lumos: raw YUYV replay frame source
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <linux/videodev2.h>
+
+#include "source.h"
+
+extern int verbose;
+
+// file:WxH[@FPS]:PATH
+//
+// A regular file is a back-to-back sequence of WxH YUYV frames and loops
+// forever. With FPS the replay follows the wall clock from the first open,
+// so a sample sees whichever frame is "playing" at that moment; without it
+// every request gets the next frame, as fast as the daemon asks.
+// A FIFO is read in order as frames arrive; FPS is ignored there.
+typedef struct {
+    int fd;
+    int ready_fd;         // timerfd (FPS), eventfd (always ready) or the FIFO itself
+    int fifo;
+    size_t frame_size;
+    off_t frames;         // Frames in a regular file
+    unsigned char *buf;
+    size_t filled;        // FIFO: bytes of the next frame read so far
+} FileSource;
+
+// Playback state survives closing the source between samples
+static char replay_path[256];
+static off_t replay_next;
+static struct timespec replay_epoch;
+
+static int parse_spec(const char *arg, CameraMode *mode, const char **path) {
+    unsigned int w, h, fps = 0;
+    int n = 0;
+    if (sscanf(arg, "%ux%u%n", &w, &h, &n) != 2) return -1;
+    arg += n;
+    if (*arg == '@') {
+        if (sscanf(arg, "@%u%n", &fps, &n) != 1) return -1;
+        arg += n;
+    }
+    if (*arg != ':' || !arg[1] || w == 0 || h == 0 || (w & 1)) return -1;
+
+    memset(mode, 0, sizeof(*mode));
+    mode->pixelformat = V4L2_PIX_FMT_YUYV;
+    mode->width = w;
+    mode->height = h;
+    if (fps) {
+        mode->interval_num = 1;
+        mode->interval_den = fps;
+    }
+    *path = arg + 1;
+    return 0;
+}
+
+static const CameraMode *file_mode(const char *arg, int probe) {
+    static CameraMode mode;
+    const char *path;
+    return parse_spec(arg, &mode, &path) == 0 ? &mode : NULL;
+}
+
+static int file_open(FrameSource *src, const char *arg, const CameraMode *mode) {
+    const char *path;
+    CameraMode parsed;
+    if (parse_spec(arg, &parsed, &path) < 0) return -1;
+
+    FileSource *fs = calloc(1, sizeof(*fs));
+    if (!fs) return -1;
+    fs->ready_fd = -1;
+    fs->frame_size = (size_t)mode->width * mode->height * 2;
+    fs->buf = malloc(fs->frame_size);
+    fs->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    struct stat st;
+    if (!fs->buf || fs->fd < 0 || fstat(fs->fd, &st) < 0) {
+        if (verbose) perror("Replay source open failed");
+        goto fail;
+    }
+
+    fs->fifo = S_ISFIFO(st.st_mode);
+    if (fs->fifo) {
+        fs->ready_fd = fs->fd;
+    } else {
+        fs->frames = st.st_size / fs->frame_size;
+        if (fs->frames == 0) {
+            if (verbose) fprintf(stderr, "%s holds no complete %ux%u frame\n", path, mode->width, mode->height);
+            goto fail;
+        }
+        if (strcmp(replay_path, path) != 0) {
+            snprintf(replay_path, sizeof(replay_path), "%s", path);
+            replay_next = 0;
+            clock_gettime(CLOCK_MONOTONIC, &replay_epoch);
+        }
+
+        if (mode->interval_den) {
+            fs->ready_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            long period_ns = 1000000000L / mode->interval_den;
+            struct itimerspec its = {
+                .it_interval = { period_ns / 1000000000L, period_ns % 1000000000L },
+                .it_value = { 0, 1 } // First frame right away
+            };
+            if (fs->ready_fd < 0 || timerfd_settime(fs->ready_fd, 0, &its, NULL) < 0) goto fail;
+        } else {
+            // Never drained, so it always polls readable
+            fs->ready_fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (fs->ready_fd < 0) goto fail;
+        }
+    }
+
+    src->priv = fs;
+    src->fd = fs->ready_fd;
+    if (verbose) printf("Replaying %s (%ux%u)\n", path, mode->width, mode->height);
+    return 0;
+
+fail:
+    if (fs->ready_fd >= 0 && fs->ready_fd != fs->fd) close(fs->ready_fd);
+    if (fs->fd >= 0) close(fs->fd);
+    free(fs->buf);
+    free(fs);
+    return -1;
+}
+
+static void file_close(FrameSource *src) {
+    FileSource *fs = src->priv;
+    if (fs->ready_fd != fs->fd) close(fs->ready_fd);
+    close(fs->fd);
+    free(fs->buf);
+    free(fs);
+}
+
+static int fifo_dequeue(FileSource *fs, CameraFrame *frame) {
+    while (fs->filled < fs->frame_size) {
+        ssize_t n = read(fs->fd, fs->buf + fs->filled, fs->frame_size - fs->filled);
+        if (n > 0) fs->filled += n;
+        else if (n < 0 && errno == EAGAIN) return 0;
+        else if (n < 0 && errno == EINTR) continue;
+        else return -1; // Writer went away
+    }
+    fs->filled = 0;
+    frame->data = fs->buf;
+    frame->bytesused = fs->frame_size;
+    frame->index = 0;
+    return 1;
+}
+
+static int file_dequeue(FrameSource *src, CameraFrame *frame) {
+    FileSource *fs = src->priv;
+    if (fs->fifo) return fifo_dequeue(fs, frame);
+
+    off_t index;
+    if (src->mode.interval_den) {
+        uint64_t ticks;
+        if (read(fs->ready_fd, &ticks, sizeof(ticks)) != sizeof(ticks)) return errno == EAGAIN ? 0 : -1;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double t = (now.tv_sec - replay_epoch.tv_sec) + (now.tv_nsec - replay_epoch.tv_nsec) / 1e9;
+        index = (off_t)(t * src->mode.interval_den / src->mode.interval_num) % fs->frames;
+    } else {
+        index = replay_next++ % fs->frames;
+    }
+
+    if (pread(fs->fd, fs->buf, fs->frame_size, index * (off_t)fs->frame_size) != (ssize_t)fs->frame_size) return -1;
+    frame->data = fs->buf;
+    frame->bytesused = fs->frame_size;
+    frame->index = 0;
+    return 1;
+}
+
+static void file_requeue(FrameSource *src, const CameraFrame *frame) {
+}
+
+static void file_flush(FrameSource *src) {
+    FileSource *fs = src->priv;
+    if (!fs->fifo) return;
+
+    // Skip whole frames the writer queued while nobody was sampling,
+    // keeping any partial one so we stay aligned to frame boundaries
+    CameraFrame frame;
+    while (fifo_dequeue(fs, &frame) == 1) {
+    }
+}
+
+const FrameSourceOps file_source = {
+    .prefix = "file:",
+    .mode = file_mode,
+    .open = file_open,
+    .close = file_close,
+    .dequeue = file_dequeue,
+    .requeue = file_requeue,
+    .flush = file_flush
+};
@@ -0,0 +1,172 @@
+/*
+ * Lumos: synthetic frame source
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <linux/videodev2.h>
+
+#include "source.h"
+
+extern int verbose;
+
+// synth:LEVEL[-LEVEL]/SECS[,...]
+//
+// Flat frames whose luma follows a looping program of holds and linear
+// ramps, e.g. "synth:30/20,30-220/60,220/20" dims, brightens over a minute
+// and holds. The program clock starts at the first open and keeps running
+// while the source is closed, like daylight would. Frames are always ready,
+// so the daemon meters as fast as it likes. Manual exposure scales the
+// level the way a real sensor would, clipping at 255.
+#define SYNTH_WIDTH 160
+#define SYNTH_HEIGHT 120
+#define SYNTH_EXPOSURE_REF 100
+
+typedef struct {
+    SynthProgram program;
+    unsigned char buf[SYNTH_WIDTH * SYNTH_HEIGHT * 2];
+    CameraExposure exposure;
+} SynthSource;
+
+static struct timespec program_epoch;
+
+int synth_parse(const char *arg, SynthProgram *p) {
+    p->n_segments = 0;
+    p->total = 0.0;
+    while (*arg) {
+        if (p->n_segments == SYNTH_MAX_SEGMENTS) return -1;
+        SynthSegment *seg = &p->segments[p->n_segments];
+        int n = 0;
+        if (sscanf(arg, "%lf-%lf/%lf%n", &seg->from, &seg->to, &seg->seconds, &n) != 3) {
+            if (sscanf(arg, "%lf/%lf%n", &seg->from, &seg->seconds, &n) != 2) return -1;
+            seg->to = seg->from;
+        }
+        if (seg->seconds <= 0.0 || seg->from < 0.0 || seg->from > 255.0 || seg->to < 0.0 || seg->to > 255.0)
+            return -1;
+        p->total += seg->seconds;
+        p->n_segments++;
+
+        arg += n;
+        if (*arg == ',') arg++;
+        else if (*arg) return -1;
+    }
+    return p->n_segments > 0 ? 0 : -1;
+}
+
+double synth_level(const SynthProgram *p, double t) {
+    t = fmod(t, p->total);
+    for (int i = 0; i < p->n_segments; i++) {
+        const SynthSegment *seg = &p->segments[i];
+        if (t < seg->seconds) return seg->from + (seg->to - seg->from) * (t / seg->seconds);
+        t -= seg->seconds;
+    }
+    return p->segments[p->n_segments - 1].to;
+}
+
+static const CameraMode *synth_mode(const char *arg, int probe) {
+    static const CameraMode mode = {
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = SYNTH_WIDTH,
+        .height = SYNTH_HEIGHT,
+        .interval_num = 1,
+        .interval_den = 30
+    };
+    SynthProgram check;
+    return synth_parse(arg, &check) == 0 ? &mode : NULL;
+}
+
+static int synth_open(FrameSource *src, const char *arg, const CameraMode *mode) {
+    SynthSource *ss = calloc(1, sizeof(*ss));
+    if (!ss || synth_parse(arg, &ss->program) < 0) {
+        free(ss);
+        return -1;
+    }
+    // Never drained, so it always polls readable
+    src->fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (src->fd < 0) {
+        free(ss);
+        return -1;
+    }
+
+    if (program_epoch.tv_sec == 0 && program_epoch.tv_nsec == 0) clock_gettime(CLOCK_MONOTONIC, &program_epoch);
+    src->priv = ss;
+    if (verbose) printf("Synthetic source: %d segment(s), %.0f s loop\n", ss->program.n_segments, ss->program.total);
+    return 0;
+}
+
+static void synth_close(FrameSource *src) {
+    close(src->fd);
+    free(src->priv);
+}
+
+static int synth_dequeue(FrameSource *src, CameraFrame *frame) {
+    SynthSource *ss = src->priv;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double t = (now.tv_sec - program_epoch.tv_sec) + (now.tv_nsec - program_epoch.tv_nsec) / 1e9;
+    double level = synth_level(&ss->program, t);
+    if (ss->exposure.locked) level = level * ss->exposure.value / ss->exposure.ref;
+    unsigned char y = level >= 255.0 ? 255 : (unsigned char)lround(level);
+
+    for (size_t i = 0; i < sizeof(ss->buf); i += 2) {
+        ss->buf[i] = y;
+        ss->buf[i + 1] = 128;
+    }
+    frame->data = ss->buf;
+    frame->bytesused = sizeof(ss->buf);
+    frame->index = 0;
+    return 1;
+}
+
+static void synth_requeue(FrameSource *src, const CameraFrame *frame) {
+}
+
+static void synth_flush(FrameSource *src) {
+}
+
+static int synth_exposure_set(FrameSource *src, long value) {
+    CameraExposure *e = &((SynthSource *)src->priv)->exposure;
+    if (value < e->min) value = e->min;
+    if (value > e->max) value = e->max;
+    e->value = value;
+    return 0;
+}
+
+static int synth_exposure_lock(FrameSource *src, long start) {
+    CameraExposure *e = &((SynthSource *)src->priv)->exposure;
+    if (e->locked) return 0;
+    e->ref = SYNTH_EXPOSURE_REF;
+    e->min = 1;
+    e->max = SYNTH_EXPOSURE_REF * 100;
+    e->locked = 1;
+    return synth_exposure_set(src, start > 0 ? start : e->ref);
+}
+
+static void synth_exposure_unlock(FrameSource *src) {
+    ((SynthSource *)src->priv)->exposure.locked = 0;
+}
+
+static CameraExposure *synth_exposure(FrameSource *src) {
+    return &((SynthSource *)src->priv)->exposure;
+}
+
+const FrameSourceOps synth_source = {
+    .prefix = "synth:",
+    .mode = synth_mode,
+    .open = synth_open,
+    .close = synth_close,
+    .dequeue = synth_dequeue,
+    .requeue = synth_requeue,
+    .flush = synth_flush,
+    .exposure_lock = synth_exposure_lock,
+    .exposure_set = synth_exposure_set,
+    .exposure_unlock = synth_exposure_unlock,
+    .exposure = synth_exposure
+};
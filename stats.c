@@ -0,0 +1,141 @@
+/*
+ * Lumos: latency histograms and counters
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *stage_names[STAGE_COUNT] = {
+    "camera_open", "format_set", "stream_on", "frame_wait", "luma",
+    "sample", "als_read", "sysfs_read", "sysfs_write", "display_write", "ipc"
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[COUNT_COUNT] = {
+    { "samples", "Completed ambient light samples." },
+    { "capture_failures", "Samples abandoned because the camera failed." },
+    { "capture_timeouts", "Samples abandoned because the camera stopped delivering frames." },
+    { "capture_busy", "Samples deferred because another application held the camera." },
+    { "frames", "Camera frames metered." },
+    { "frames_corrupt", "Camera frames dropped because they could not be decoded." },
+    { "backlight_writes", "Brightness levels written to a display." },
+    { "backlight_writes_skipped", "Writes skipped because the level was already set." },
+    { "backlight_write_failures", "Failed brightness writes." },
+    { "backlight_writes_coalesced", "Queued display writes replaced by a newer level before being sent." },
+    { "ipc_commands", "Control socket commands handled." }
+};
+
+static StatsHistogram histograms[STAGE_COUNT];
+static uint64_t counters[COUNT_COUNT];
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns) {
+    uint64_t us = (ns + 999) / 1000;
+    if (us <= 1) return 0;
+    int b = 64 - __builtin_clzll(us - 1); // Smallest b with 2^b >= us
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS;
+}
+
+void stats_add(StatsStage stage, uint64_t ns) {
+    StatsHistogram *h = &histograms[stage];
+    __atomic_fetch_add(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_record(StatsStage stage, uint64_t start) {
+    stats_add(stage, stats_now() - start);
+}
+
+void stats_count(StatsCounter counter) {
+    __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+const StatsHistogram *stats_histogram(StatsStage stage) {
+    return &histograms[stage];
+}
+
+uint64_t stats_counter(StatsCounter counter) {
+    return counters[counter];
+}
+
+// Upper bound of the bucket holding quantile q, capped at the observed max
+static double quantile_us(const StatsHistogram *h, double q) {
+    if (h->count == 0) return 0.0;
+    uint64_t rank = (uint64_t)(q * (h->count - 1)) + 1, seen = 0;
+    double max_us = h->max_ns / 1000.0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            double bound = (double)(1ull << b);
+            return bound < max_us ? bound : max_us;
+        }
+    }
+    return max_us;
+}
+
+void stats_format(char *buf, size_t len) {
+    size_t off = 0;
+    buf[0] = '\0';
+    for (int s = 0; s < STAGE_COUNT && off < len; s++) {
+        const StatsHistogram *h = &histograms[s];
+        off += snprintf(buf + off, len - off, "%s%s_count=%llu %s_p50_us=%.1f %s_p99_us=%.1f %s_max_us=%.1f",
+                        s ? " " : "", stage_names[s], (unsigned long long)h->count,
+                        stage_names[s], quantile_us(h, 0.5), stage_names[s], quantile_us(h, 0.99),
+                        stage_names[s], h->max_ns / 1000.0);
+    }
+    for (int c = 0; c < COUNT_COUNT && off < len; c++) {
+        off += snprintf(buf + off, len - off, " %s=%llu", counter_info[c].name,
+                        (unsigned long long)counters[c]);
+    }
+}
+
+int stats_export(const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path); // node-exporter only reads *.prom
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+
+    fprintf(f, "# HELP lumos_stage_duration_seconds Time spent in each stage of the sample loop.\n");
+    fprintf(f, "# TYPE lumos_stage_duration_seconds histogram\n");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const StatsHistogram *h = &histograms[s];
+        uint64_t cumulative = 0;
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            cumulative += h->buckets[b];
+            fprintf(f, "lumos_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.7g\"} %llu\n",
+                    stage_names[s], (double)(1ull << b) / 1e6, (unsigned long long)cumulative);
+        }
+        fprintf(f, "lumos_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                stage_names[s], (unsigned long long)h->count);
+        fprintf(f, "lumos_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[s], h->sum_ns / 1e9);
+        fprintf(f, "lumos_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+                stage_names[s], (unsigned long long)h->count);
+    }
+
+    for (int c = 0; c < COUNT_COUNT; c++) {
+        fprintf(f, "# HELP lumos_%s_total %s\n", counter_info[c].name, counter_info[c].help);
+        fprintf(f, "# TYPE lumos_%s_total counter\n", counter_info[c].name);
+        fprintf(f, "lumos_%s_total %llu\n", counter_info[c].name, (unsigned long long)counters[c]);
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
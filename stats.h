@@ -0,0 +1,70 @@
+/*
+ * Lumos: latency histograms and counters
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_STATS_H
+#define LUMOS_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    STAGE_CAMERA_OPEN,
+    STAGE_FORMAT_SET,
+    STAGE_STREAM_ON,
+    STAGE_FRAME_WAIT,    // From asking for a frame (or the previous one) until it is ready
+    STAGE_LUMA,
+    STAGE_SAMPLE,        // Whole sample, first frame request to decision
+    STAGE_ALS_READ,      // One ambient light sensor reading
+    STAGE_SYSFS_READ,
+    STAGE_SYSFS_WRITE,
+    STAGE_DISPLAY_WRITE, // One write on an async display's writer thread (DDC/CI)
+    STAGE_IPC,           // One command, parse to reply queued
+    STAGE_COUNT
+} StatsStage;
+
+typedef enum {
+    COUNT_SAMPLES,
+    COUNT_CAPTURE_FAILURES,
+    COUNT_CAPTURE_TIMEOUTS, // Camera stopped delivering frames mid-sample
+    COUNT_CAPTURE_BUSY,     // Camera held by another application
+    COUNT_FRAMES,
+    COUNT_FRAMES_CORRUPT,   // Compressed frames that could not be read
+    COUNT_WRITES,
+    COUNT_WRITES_SKIPPED,   // Level already there; no sysfs write needed
+    COUNT_WRITE_FAILURES,
+    COUNT_WRITES_COALESCED, // Superseded before a slow display's writer got to it
+    COUNT_IPC_COMMANDS,
+    COUNT_COUNT
+} StatsCounter;
+
+// Log-scale buckets with upper bounds 1us, 2us, 4us ... 2^23us (~8.4s), plus overflow
+#define STATS_BUCKETS 24
+
+typedef struct {
+    uint64_t buckets[STATS_BUCKETS + 1];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} StatsHistogram;
+
+// Recording is safe from the display writer threads as well as the main loop
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t stats_now(void);
+// Records the time elapsed since start (from stats_now())
+void stats_record(StatsStage stage, uint64_t start);
+void stats_add(StatsStage stage, uint64_t ns);
+void stats_count(StatsCounter counter);
+
+const StatsHistogram *stats_histogram(StatsStage stage);
+uint64_t stats_counter(StatsCounter counter);
+
+// One line of key=value pairs for the STATS command (no trailing newline)
+void stats_format(char *buf, size_t len);
+// node-exporter textfile; written to a temp file and renamed into place
+int stats_export(const char *path);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Lumos: shared-memory status page
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "status.h"
+
+#define PAYLOAD_OFFSET offsetof(LumosStatus, pid)
+#define READ_RETRIES 64
+
+LumosStatus *status_create(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    fchmod(fd, 0644); // World-readable regardless of umask
+
+    LumosStatus *page = MAP_FAILED;
+    if (ftruncate(fd, sizeof(LumosStatus)) == 0)
+        page = mmap(NULL, sizeof(LumosStatus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) return NULL;
+
+    // Reusing the file keeps readers of a previous instance attached
+    LumosStatus init;
+    memset(&init, 0, sizeof(init));
+    init.pid = getpid();
+    init.luma = -1;
+    init.target = -1;
+    init.brightness = -1;
+    page->magic = STATUS_MAGIC;
+    page->version = STATUS_VERSION;
+    status_publish(page, &init);
+    return page;
+}
+
+void status_publish(LumosStatus *page, const LumosStatus *next) {
+    const char *src = (const char *)next + PAYLOAD_OFFSET;
+    char *dst = (char *)page + PAYLOAD_OFFSET;
+    size_t len = sizeof(LumosStatus) - PAYLOAD_OFFSET;
+    size_t gen_off = offsetof(LumosStatus, generation) - PAYLOAD_OFFSET;
+    size_t gen_end = gen_off + sizeof(page->generation);
+
+    // Ignore the generation when comparing, it is ours to bump
+    if (memcmp(dst, src, gen_off) == 0 && memcmp(dst + gen_end, src + gen_end, len - gen_end) == 0)
+        return;
+
+    uint32_t seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint64_t generation = page->generation + 1;
+    memcpy(dst, src, len);
+    page->generation = generation;
+
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void status_destroy(LumosStatus *page) {
+    if (!page) return;
+    LumosStatus last = *page;
+    last.pid = 0;
+    status_publish(page, &last);
+    munmap(page, sizeof(LumosStatus));
+}
+
+const LumosStatus *status_map(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    const LumosStatus *page = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(LumosStatus))
+        page = mmap(NULL, sizeof(LumosStatus), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return page == MAP_FAILED ? NULL : page;
+}
+
+void status_unmap(const LumosStatus *page) {
+    if (page) munmap((void *)page, sizeof(LumosStatus));
+}
+
+int status_read(const LumosStatus *page, LumosStatus *out) {
+    for (int i = 0; i < READ_RETRIES; i++) {
+        uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue; // Mid-update
+
+        memcpy(out, page, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        if (out->magic != STATUS_MAGIC || out->version != STATUS_VERSION || out->pid == 0) return -1;
+        return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,58 @@
+/*
+ * Lumos: shared-memory status page
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_STATUS_H
+#define LUMOS_STATUS_H
+
+#include <stdint.h>
+
+#define STATUS_PATH "/run/lumos.status"
+#define STATUS_MAGIC 0x534d554cu   // "LUMS"
+#define STATUS_VERSION 1
+
+// Live daemon state, mmap-ed read-only by clients. The daemon is the only
+// writer; readers retry while seq is odd or changes under them (seqlock).
+// Fixed-width fields, no padding: lumos-gui.py unpacks the same layout.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    int32_t pid;             // 0 once the daemon has exited
+    uint64_t generation;     // Bumped whenever anything below changes
+    int64_t sample_time_ms;  // CLOCK_REALTIME of the last sample, 0 before the first
+    int32_t luma;            // -1 before the first sample
+    int32_t target;          // Percent
+    int32_t brightness;      // Percent
+    int32_t mode;            // 0=Auto, 1=Manual
+    int32_t min_brightness;
+    int32_t max_brightness;
+    int32_t interval;
+    int32_t brightness_offset;
+    float sensitivity;
+    int32_t manual_brightness;
+    int32_t stream_idle;
+    int32_t exposure_lock;
+    int32_t ramp_ms;
+    int32_t ramp_hz;
+    char camera_dev[64];
+    char camera_mode[32];
+    uint64_t history_seq;    // Newest HISTORY entry; poll this instead of the socket
+} LumosStatus;
+
+// Daemon side: creates (or reuses) the page and stamps it with our pid
+LumosStatus *status_create(const char *path);
+// Copies everything from pid onwards into the page if it differs
+void status_publish(LumosStatus *page, const LumosStatus *next);
+// Marks the page as abandoned; the file stays so readers can see that
+void status_destroy(LumosStatus *page);
+
+// Client side: read-only mapping, NULL if the daemon hasn't created one
+const LumosStatus *status_map(const char *path);
+void status_unmap(const LumosStatus *page);
+// Consistent snapshot; -1 if the page is stale or keeps changing under us
+int status_read(const LumosStatus *page, LumosStatus *out);
+
+#endif
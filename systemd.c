@@ -0,0 +1,67 @@
+/*
+ * Lumos: systemd socket activation and readiness
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "systemd.h"
+
+extern int verbose;
+
+#define LISTEN_FDS_START 3 // SD_LISTEN_FDS_START
+
+int systemd_listen_fd(void) {
+    const char *pid = getenv("LISTEN_PID");
+    const char *fds = getenv("LISTEN_FDS");
+    int n = fds ? atoi(fds) : 0;
+    int ours = pid && atol(pid) == (long)getpid();
+
+    // Not for any child we might start
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if (!ours || n < 1) return -1;
+
+    int fd = LISTEN_FDS_START;
+    struct stat st;
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (fstat(fd, &st) < 0 || !S_ISSOCK(st.st_mode) || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 ||
+        type != SOCK_STREAM) {
+        if (verbose) fprintf(stderr, "Ignoring inherited fd %d: not a stream socket\n", fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+void systemd_notify(const char *state) {
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (!path || (path[0] != '/' && path[0] != '@')) return;
+
+    struct sockaddr_un addr;
+    size_t n = strlen(path);
+    if (n >= sizeof(addr.sun_path)) return;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, n);
+    if (addr.sun_path[0] == '@') addr.sun_path[0] = '\0'; // Abstract namespace
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return;
+    if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&addr,
+               offsetof(struct sockaddr_un, sun_path) + n) < 0 && verbose)
+        perror("sd_notify");
+    close(fd);
+}
@@ -0,0 +1,17 @@
+/*
+ * Lumos: systemd socket activation and readiness
+ * Author: Anıl Aras
+ * License: MIT
+ */
+
+#ifndef LUMOS_SYSTEMD_H
+#define LUMOS_SYSTEMD_H
+
+// The listening socket passed by socket activation (LISTEN_PID/LISTEN_FDS),
+// made non-blocking; -1 when not started that way. Only the first is used.
+int systemd_listen_fd(void);
+
+// sd_notify(3) without libsystemd, e.g. "READY=1"; a no-op outside systemd
+void systemd_notify(const char *state);
+
+#endif
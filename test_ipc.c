@@ -0,0 +1,224 @@
+/*
+ * Lumos: IPC framing tests
+ * Author: Anıl Aras
+ * License: MIT
+ *
+ * Runs against a real daemon started in a temp dir. Whether a client speaks
+ * the line protocol or the legacy one-shot one is only settled by its first
+ * newline, so commands split across writes must come out right both ways:
+ * a framed client keeps its connection and gets the whole line run, a
+ * legacy client gets its whole command run once it goes quiet or shuts
+ * down its end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define DAEMON_START_TIMEOUT 5.0
+#define REPLY_TIMEOUT_MS 2000
+#define SPLIT_GAP_US 50000 // Well inside the daemon's LEGACY_QUIET
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        failures++; \
+    } \
+} while (0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fputs(text, f);
+    fclose(f);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+static int connect_to(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_str(int fd, const char *s) {
+    if (write(fd, s, strlen(s)) < 0) perror("write");
+}
+
+// One reply line without its newline; -1 on timeout or a closed connection
+static int read_line(int fd, char *line, size_t len) {
+    size_t n = 0;
+    while (n < len - 1) {
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        if (poll(&p, 1, REPLY_TIMEOUT_MS) <= 0 || read(fd, line + n, 1) != 1) return -1;
+        if (line[n] == '\n') break;
+        n++;
+    }
+    line[n] = '\0';
+    return 0;
+}
+
+// 1 once the daemon has closed the connection, 0 if it is still open
+static int closed_by_daemon(int fd) {
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    char c;
+    return poll(&p, 1, REPLY_TIMEOUT_MS) == 1 && read(fd, &c, 1) == 0;
+}
+
+static pid_t start_daemon(const char *daemon, const char *dir, char *socket_path, size_t len) {
+    char bl_dir[512], conf[512], path[600];
+    snprintf(bl_dir, sizeof(bl_dir), "%s/bl", dir);
+    mkdir(bl_dir, 0755);
+    snprintf(path, sizeof(path), "%s/max_brightness", bl_dir);
+    write_file(path, "1000\n");
+    snprintf(path, sizeof(path), "%s/brightness", bl_dir);
+    write_file(path, "500\n");
+    snprintf(conf, sizeof(conf), "%s/lumos.conf", dir);
+    write_file(conf, "mode=manual\nmanual_brightness=50\nramp_ms=0\ncamera_dev=synth:128/60\n");
+    snprintf(socket_path, len, "%s/lumos.sock", dir);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execl(daemon, daemon, "-c", conf, "-b", bl_dir, "-r", dir, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) return -1;
+
+    double deadline = now_s() + DAEMON_START_TIMEOUT;
+    while (now_s() < deadline) {
+        int fd = connect_to(socket_path);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) return -1;
+        usleep(10000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// "GET mo" then "de\n": one command, and the connection stays up for more
+static void test_framed_split(const char *socket_path) {
+    char line[128];
+    int fd = connect_to(socket_path);
+    send_str(fd, "GET mo");
+    usleep(SPLIT_GAP_US);
+    send_str(fd, "de\n");
+    CHECK(read_line(fd, line, sizeof(line)) == 0 && strcmp(line, "manual") == 0,
+          "framed split command: got '%s'", line);
+    send_str(fd, "GET manual_brightness\n");
+    CHECK(read_line(fd, line, sizeof(line)) == 0 && strcmp(line, "50") == 0,
+          "second command after a split one: got '%s'", line);
+    close(fd);
+}
+
+// A line split over a newline-less first read and a pipelined rest
+static void test_framed_split_pipelined(const char *socket_path) {
+    char line[128];
+    int fd = connect_to(socket_path);
+    send_str(fd, "GET manual_bri");
+    usleep(SPLIT_GAP_US);
+    send_str(fd, "ghtness\nGET mode\n");
+    CHECK(read_line(fd, line, sizeof(line)) == 0 && strcmp(line, "50") == 0, "first pipelined reply: '%s'", line);
+    CHECK(read_line(fd, line, sizeof(line)) == 0 && strcmp(line, "manual") == 0, "second pipelined reply: '%s'", line);
+    close(fd);
+}
+
+// Legacy: "GET mo" then "de", no newline ever; runs once the client goes quiet
+static void test_legacy_split(const char *socket_path) {
+    char line[128];
+    int fd = connect_to(socket_path);
+    send_str(fd, "GET mo");
+    usleep(SPLIT_GAP_US);
+    send_str(fd, "de");
+    CHECK(read_line(fd, line, sizeof(line)) == 0 && strcmp(line, "manual") == 0, "legacy split command: got '%s'", line);
+    CHECK(closed_by_daemon(fd), "legacy connection left open");
+    close(fd);
+}
+
+// Legacy with a half-close, as `printf 'GET mode' | socat` does: no waiting
+static void test_legacy_eof(const char *socket_path) {
+    char line[128];
+    int fd = connect_to(socket_path);
+    double start = now_s();
+    send_str(fd, "GET mo");
+    usleep(SPLIT_GAP_US);
+    send_str(fd, "de");
+    shutdown(fd, SHUT_WR);
+    CHECK(read_line(fd, line, sizeof(line)) == 0 && strcmp(line, "manual") == 0, "legacy command at EOF: got '%s'", line);
+    CHECK(now_s() - start < 0.18, "legacy reply at EOF took %.3f s", now_s() - start);
+    CHECK(closed_by_daemon(fd), "legacy connection left open after EOF");
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    const char *daemon = argc > 1 ? argv[1] : "./lumos";
+    char dir[] = "/tmp/lumos-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    char socket_path[600];
+    pid_t pid = start_daemon(daemon, dir, socket_path, sizeof(socket_path));
+    if (pid < 0) {
+        fprintf(stderr, "test_ipc: could not start %s\n", daemon);
+        nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+        return 1;
+    }
+
+    test_framed_split(socket_path);
+    test_framed_split_pipelined(socket_path);
+    test_legacy_split(socket_path);
+    test_legacy_eof(socket_path);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+
+    if (failures) {
+        fprintf(stderr, "test_ipc: %d failed\n", failures);
+        return 1;
+    }
+    printf("test_ipc: ok\n");
+    return 0;
+}
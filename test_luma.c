@@ -0,0 +1,111 @@
+/*
+ * Lumos: luma kernel tests
+ * Author: Anıl Aras
+ * License: MIT
+ *
+ * Every kernel the CPU can run must agree exactly with the scalar reference:
+ * random and constant buffers, every length up to a few vector widths (odd
+ * ones included, so the tail loops run) and every start offset within a
+ * vector. Each buffer is allocated to its exact size, so the sanitizers
+ * `make test` builds with catch a kernel that reads past the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "luma.h"
+
+#define MAX_LEN 300      // Bytes; a few AVX2 iterations plus every tail
+#define MAX_OFFSET 64
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+static const size_t big_lens[] = { 4096, 4097, 4098 + 63, 640 * 480 * 2 + 5 };
+
+static int failures = 0;
+
+static int stats_equal(const LumaStats *a, const LumaStats *b) {
+    return a->count == b->count && a->min == b->min && a->max == b->max && a->mean == b->mean &&
+           memcmp(a->hist, b->hist, sizeof(a->hist)) == 0;
+}
+
+// Copies src to a fresh allocation ending exactly at offset + len
+static void check(const char *name, const unsigned char *src, size_t len, size_t offset, const char *what) {
+    unsigned char *buf = malloc(offset + len ? offset + len : 1);
+    if (!buf) abort();
+    unsigned char *data = buf + offset;
+    memcpy(data, src, len);
+
+    LumaStats want, got;
+    luma_stats_yuyv_scalar(data, len, &want);
+    memset(&got, 0xA5, sizeof(got));
+    luma_stats_yuyv(data, len, &got);
+    if (!stats_equal(&want, &got)) {
+        if (failures < 10) {
+            fprintf(stderr, "FAIL %s, %s, %zu bytes at offset %zu: count %u/%u min %u/%u max %u/%u mean %.4f/%.4f\n",
+                    name, what, len, offset, got.count, want.count, got.min, want.min, got.max, want.max,
+                    got.mean, want.mean);
+        }
+        failures++;
+    }
+    free(buf);
+}
+
+static void fill_random(unsigned char *p, size_t n, unsigned int *seed) {
+    for (size_t i = 0; i < n; i++) p[i] = rand_r(seed) >> 7;
+}
+
+static void test_kernel(const char *name) {
+    size_t big = big_lens[sizeof(big_lens) / sizeof(big_lens[0]) - 1];
+    unsigned char *src = malloc(big);
+    if (!src) abort();
+    unsigned int seed = 1;
+
+    for (size_t len = 0; len <= MAX_LEN; len++) {
+        for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+            fill_random(src, len, &seed);
+            check(name, src, len, offset, "random");
+        }
+    }
+
+    // Extremes, where min/max start values and signed compares go wrong
+    static const int fills[] = { 0x00, 0xFF, 0x80, 0x7F };
+    for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); f++) {
+        for (size_t len = 0; len <= MAX_LEN; len += 7) {
+            memset(src, fills[f], len);
+            check(name, src, len, len % MAX_OFFSET, "constant");
+        }
+    }
+    // One dark and one bright pixel in the tail of a mid-grey frame
+    for (size_t len = 2; len <= MAX_LEN; len++) {
+        memset(src, 0x80, len);
+        src[(len - 1) & ~(size_t)1] = 0x00;
+        src[len / 2 & ~(size_t)1] = 0xFF;
+        check(name, src, len, 3, "outliers");
+    }
+
+    for (size_t i = 0; i < sizeof(big_lens) / sizeof(big_lens[0]); i++) {
+        fill_random(src, big_lens[i], &seed);
+        check(name, src, big_lens[i], 0, "random");
+        check(name, src, big_lens[i], 1, "random");
+        check(name, src, big_lens[i], 31, "random");
+    }
+    free(src);
+}
+
+int main(void) {
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (luma_kernel_select(kernels[k]) < 0) {
+            printf("test_luma: %s not available, skipped\n", kernels[k]);
+            continue;
+        }
+        test_kernel(kernels[k]);
+    }
+
+    if (failures) {
+        fprintf(stderr, "test_luma: %d failed\n", failures);
+        return 1;
+    }
+    printf("test_luma: ok\n");
+    return 0;
+}
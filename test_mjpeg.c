@@ -0,0 +1,246 @@
+/*
+ * Lumos: MJPEG decoder tests
+ * Author: Anıl Aras
+ * License: MIT
+ *
+ * A hand-built 16x8 grayscale frame must meter to known values, and
+ * malformed DHT, SOF and SOS segments, truncations and byte flips of it must
+ * be rejected without touching memory they shouldn't. Built with the address
+ * and undefined behaviour sanitizers by `make test`, which is what catches
+ * the latter.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "luma.h"
+
+#define FRAME_MAX 4096
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        failures++; \
+    } \
+} while (0)
+
+typedef struct {
+    unsigned char b[FRAME_MAX];
+    size_t n;
+} Frame;
+
+static void put(Frame *f, const void *p, size_t n) {
+    memcpy(f->b + f->n, p, n);
+    f->n += n;
+}
+
+static void put_segment(Frame *f, int marker, const unsigned char *p, size_t n) {
+    unsigned char h[4] = { 0xFF, marker, (n + 2) >> 8, (n + 2) & 0xFF };
+    put(f, h, 4);
+    put(f, p, n);
+}
+
+// DQT table 0 with a DC quantizer of 8, so block mean = DC + 128
+static const unsigned char dqt[65] = { 0x00, 8, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+// 8 lines of 16, one component, 1x1 sampling
+static const unsigned char sof[9] = { 8, 0, 8, 0, 16, 1, 1, 0x11, 0 };
+static const unsigned char sos[6] = { 1, 1, 0x00, 0, 63, 0 };
+// Standard tables: DC +2 then EOB, DC -2 then EOB, padded with ones
+static const unsigned char scan[3] = { 0x75, 0x36, 0xBF };
+
+// The valid frame, with an extra segment in front of the SOF when given
+static void build(Frame *f, int marker, const unsigned char *seg, size_t len) {
+    static const unsigned char soi[2] = { 0xFF, 0xD8 }, eoi[2] = { 0xFF, 0xD9 };
+    f->n = 0;
+    put(f, soi, 2);
+    put_segment(f, 0xDB, dqt, sizeof(dqt));
+    if (seg) put_segment(f, marker, seg, len);
+    put_segment(f, 0xC0, sof, sizeof(sof));
+    put_segment(f, 0xDA, sos, sizeof(sos));
+    put(f, scan, sizeof(scan));
+    put(f, eoi, 2);
+}
+
+static int meter(const Frame *f, LumaStats *st) {
+    return luma_stats_mjpeg(f->b, f->n, st);
+}
+
+static void test_valid(void) {
+    Frame f;
+    LumaStats st;
+    build(&f, 0, NULL, 0);
+    CHECK(meter(&f, &st) == 0, "valid frame rejected");
+    CHECK(st.count == 2, "count %u, want 2", st.count);
+    CHECK(st.min == 128 && st.max == 130, "min %u max %u, want 128 130", st.min, st.max);
+    CHECK(st.mean == 129.0, "mean %.2f, want 129", st.mean);
+    CHECK(st.hist[128] == 1 && st.hist[130] == 1, "histogram");
+}
+
+// DHT class 0 table 0 with the given counts and values 0, 1, 2...
+static void test_dht(const char *what, const uint8_t bits[16], int want) {
+    unsigned char seg[1 + 16 + 16 * 255];
+    size_t total = 0;
+    seg[0] = 0x00;
+    for (int i = 0; i < 16; i++) {
+        seg[1 + i] = bits[i];
+        total += bits[i];
+    }
+    for (size_t k = 0; k < total; k++) seg[17 + k] = k;
+
+    Frame f;
+    LumaStats st;
+    build(&f, 0xC4, seg, 17 + total);
+    int rc = meter(&f, &st);
+    CHECK(rc == want, "DHT %s: got %d, want %d", what, rc, want);
+}
+
+static void test_malformed_dht(void) {
+    // Three one-bit codes: the third would index the fast table past its end
+    test_dht("3 codes of length 1", (const uint8_t[16]){ 3 }, -1);
+    test_dht("255 codes of length 1", (const uint8_t[16]){ 255 }, -1);
+    test_dht("over-subscribed at length 2", (const uint8_t[16]){ 1, 3 }, -1);
+    test_dht("over-subscribed at length 10", (const uint8_t[16]){ 1, 1, 1, 1, 1, 1, 1, 1, 1, 3 }, -1);
+    test_dht("over-subscribed at length 16", (const uint8_t[16]){ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3 }, -1);
+    test_dht("more than 256 values", (const uint8_t[16]){ 200, 200 }, -1);
+    // The standard DC table sent explicitly is no different from leaving it out
+    test_dht("standard DC", (const uint8_t[16]){ 0, 1, 5, 1, 1, 1, 1, 1, 1 }, 0);
+
+    // Declared counts longer than the segment
+    Frame f;
+    LumaStats st;
+    unsigned char seg[18] = { 0x00, 0, 4 };
+    build(&f, 0xC4, seg, sizeof(seg));
+    CHECK(meter(&f, &st) == -1, "DHT shorter than its counts accepted");
+    memset(seg, 0, sizeof(seg));
+    seg[0] = 0x20;
+    seg[1] = 1;
+    build(&f, 0xC4, seg, sizeof(seg));
+    CHECK(meter(&f, &st) == -1, "DHT with class 2 accepted");
+}
+
+static void test_malformed_sof(void) {
+    static const struct {
+        const char *what;
+        int at, value;
+    } cases[] = {
+        { "12-bit precision", 0, 12 },
+        { "zero height", 2, 0 },
+        { "zero width", 4, 0 },
+        { "no components", 5, 0 },
+        { "five components", 5, 5 },
+        { "zero sampling", 7, 0x00 },
+        { "sampling 5", 7, 0x51 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        unsigned char bad[sizeof(sof)];
+        memcpy(bad, sof, sizeof(sof));
+        bad[cases[i].at] = cases[i].value;
+
+        Frame f;
+        LumaStats st;
+        f.n = 0;
+        put(&f, (const unsigned char[2]){ 0xFF, 0xD8 }, 2);
+        put_segment(&f, 0xDB, dqt, sizeof(dqt));
+        put_segment(&f, 0xC0, bad, sizeof(bad));
+        put_segment(&f, 0xDA, sos, sizeof(sos));
+        put(&f, scan, sizeof(scan));
+        CHECK(meter(&f, &st) == -1, "SOF %s accepted", cases[i].what);
+    }
+
+    // Three components declared, one present
+    Frame f;
+    LumaStats st;
+    unsigned char bad[sizeof(sof)];
+    memcpy(bad, sof, sizeof(sof));
+    bad[5] = 3;
+    f.n = 0;
+    put(&f, (const unsigned char[2]){ 0xFF, 0xD8 }, 2);
+    put_segment(&f, 0xC0, bad, sizeof(bad));
+    CHECK(meter(&f, &st) == -1, "SOF shorter than its components accepted");
+}
+
+static void test_malformed_sos(void) {
+    static const struct {
+        const char *what;
+        int at, value;
+    } cases[] = {
+        { "no components", 0, 0 },
+        { "two components in a one-component frame", 0, 2 },
+        { "unknown component", 1, 7 },
+        { "DC table 4", 2, 0x40 },
+        { "undefined AC table", 2, 0x03 },
+        { "spectral selection", 4, 5 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        unsigned char bad[sizeof(sos)];
+        memcpy(bad, sos, sizeof(sos));
+        bad[cases[i].at] = cases[i].value;
+
+        Frame f;
+        LumaStats st;
+        f.n = 0;
+        put(&f, (const unsigned char[2]){ 0xFF, 0xD8 }, 2);
+        put_segment(&f, 0xDB, dqt, sizeof(dqt));
+        put_segment(&f, 0xC0, sof, sizeof(sof));
+        put_segment(&f, 0xDA, bad, sizeof(bad));
+        put(&f, scan, sizeof(scan));
+        CHECK(meter(&f, &st) == -1, "SOS %s accepted", cases[i].what);
+    }
+
+    // Scan before any frame header, and a header cut short
+    Frame f;
+    LumaStats st;
+    f.n = 0;
+    put(&f, (const unsigned char[2]){ 0xFF, 0xD8 }, 2);
+    put_segment(&f, 0xDA, sos, sizeof(sos));
+    put(&f, scan, sizeof(scan));
+    CHECK(meter(&f, &st) == -1, "SOS before SOF accepted");
+    build(&f, 0, NULL, 0);
+    f.n -= sizeof(scan) + 2 + 3;
+    CHECK(meter(&f, &st) == -1, "truncated SOS accepted");
+}
+
+// Whatever the damage, the result is 0 or -1 and the sanitizers stay quiet
+static void test_damage(void) {
+    Frame good, f;
+    LumaStats st;
+    build(&good, 0, NULL, 0);
+
+    for (size_t n = 0; n < good.n - 2; n++) {
+        CHECK(luma_stats_mjpeg(good.b, n, &st) == -1, "frame cut to %zu bytes accepted", n);
+    }
+
+    static const unsigned char values[] = { 0x00, 0x01, 0x3F, 0x7F, 0x80, 0xC4, 0xD9, 0xDA, 0xFE, 0xFF };
+    for (size_t at = 0; at < good.n; at++) {
+        for (size_t v = 0; v < sizeof(values); v++) {
+            f = good;
+            f.b[at] = values[v];
+            int rc = meter(&f, &st);
+            CHECK(rc == 0 || rc == -1, "byte %zu set to %02x: returned %d", at, values[v], rc);
+            if (rc == 0) CHECK(st.count > 0 && st.min <= st.max, "byte %zu set to %02x: bad stats", at, values[v]);
+        }
+    }
+}
+
+int main(void) {
+    test_valid();
+    test_malformed_dht();
+    test_malformed_sof();
+    test_malformed_sos();
+    test_damage();
+
+    if (failures) {
+        fprintf(stderr, "test_mjpeg: %d failed\n", failures);
+        return 1;
+    }
+    printf("test_mjpeg: ok\n");
+    return 0;
+}